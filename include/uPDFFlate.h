@@ -0,0 +1,74 @@
+/*
+  Copyright 2021 Grégory Soutadé
+
+  This file is part of uPDFParser.
+
+  uPDFParser is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  uPDFParser is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with uPDFParser. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _UPDFFLATE_HPP_
+#define _UPDFFLATE_HPP_
+
+#include <string>
+
+namespace uPDFParser
+{
+    /**
+     * @brief Flate (zlib) support, only available if library has been
+     * compiled with zlib
+     */
+    class Flate
+    {
+    public:
+	/**
+	 * @brief Is Flate support compiled in ?
+	 */
+	static bool available();
+
+	/**
+	 * @brief Compress data (zlib format) and append it into res
+	 *
+	 * @param data    Data to compress
+	 * @param length  Length of data
+	 * @param res     Output buffer
+	 * @param level   Compression level (0-9, -1 for default)
+	 *
+	 * @return false if Flate support is not available
+	 */
+	static bool compress(const unsigned char* data, size_t length, std::string& res, int level=-1);
+
+	/**
+	 * @brief Compress data using nbThreads threads (zlib format) and append it into res
+	 * Data is split into blocks compressed independently (with previous
+	 * 32KB as dictionary), output is a single zlib stream.
+	 *
+	 * @return false if Flate support is not available
+	 */
+	static bool compress(const unsigned char* data, size_t length, std::string& res,
+			     int level, unsigned int nbThreads);
+
+	/**
+	 * @brief Size of blocks compressed by each thread
+	 */
+	static const size_t BLOCK_SIZE = 128*1024;
+
+	/**
+	 * @brief Decompress zlib data and append it into res
+	 * Raise an exception if data is invalid or if Flate support is not available
+	 */
+	static void decompress(const unsigned char* data, size_t length, std::string& res);
+    };
+}
+
+#endif
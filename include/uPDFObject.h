@@ -24,6 +24,8 @@
 
 namespace uPDFParser
 {
+    class Parser;
+
     /**
      * @brief PDF Object
      */
@@ -32,8 +34,8 @@ namespace uPDFParser
     public:
 	Object():
 	    _objectId(0), _generationNumber(0),
-	    _offset(0), _isNew(false), indirectOffset(0),
-	    _used(true)
+	    _offset(0), _endOffset(0), _isNew(false), indirectOffset(0),
+	    _used(true), _parser(0)
 	{}
 
 	/**
@@ -49,8 +51,8 @@ namespace uPDFParser
 	Object(int objectId, int generationNumber, uint64_t offset, bool isNew=false,
 	       off_t indirectOffset=0, bool used=true):
 	    _objectId(objectId), _generationNumber(generationNumber),
-	    _offset(offset), _isNew(isNew), indirectOffset(indirectOffset),
-	    _used(true)
+	    _offset(offset), _endOffset(0), _isNew(isNew), indirectOffset(indirectOffset),
+	    _used(true), _parser(0)
 	{}
 
 	~Object()
@@ -65,13 +67,20 @@ namespace uPDFParser
 	    _objectId = other._objectId;
 	    _generationNumber = other._generationNumber;
 	    _offset = other._offset;
+	    _endOffset = other._endOffset;
 	    indirectOffset = other.indirectOffset;
 	    _isNew = true;
 	    _used = other._used;
+	    _parser = 0;
 
 	    std::vector<DataType*>::const_iterator it;
 	    for(it=other._data.begin(); it!=other._data.end(); it++)
+	    {
 		_data.push_back((*it)->clone());
+		// Cloned streams must use our dictionary
+		if (_data.back()->type() == DataType::TYPE::STREAM)
+		    ((Stream*)_data.back())->setOwner(this);
+	    }
 
 	    const std::map<std::string, DataType*> _dict = ((Dictionary)other._dictionary).value();
 	    std::map<std::string, DataType*>& _myDict = _dictionary.value();
@@ -86,12 +95,12 @@ namespace uPDFParser
 	Object* clone() { return new Object(*this); }
 
 	/**
-	 * @brief Return internal dictionary
+	 * @brief Return internal dictionary (call update() once modified)
 	 */
 	Dictionary& dictionary() {return _dictionary;}
 
 	/**
-	 * @brief Return vector of data contained into object
+	 * @brief Return vector of data contained into object (call update() once modified)
 	 */
 	std::vector<DataType*>& data() {return _data;}
 
@@ -100,10 +109,36 @@ namespace uPDFParser
 	 */
 	std::string str();
 
+	/**
+	 * @brief Append object representation into sink
+	 */
+	void serialize(Sink& sink);
+
+	/**
+	 * @brief Append object content (without "obj"/"endobj" keywords) into sink
+	 */
+	void serializeContent(Sink& sink);
+
 	/**
 	 * @brief Object offset
 	 */
 	off_t offset() {return _offset;}
+
+	/**
+	 * @brief Set object offset in current PDF file
+	 */
+	void setOffset(off_t offset) {_offset = offset;}
+
+	/**
+	 * @brief End offset of object in current PDF file (0 if unknown)
+	 * Source bytes of a parsed object are in [offset(), endOffset()[
+	 */
+	off_t endOffset() {return _endOffset;}
+
+	/**
+	 * @brief Set end offset of object in current PDF file
+	 */
+	void setEndOffset(off_t endOffset) {_endOffset = endOffset;}
 	
 	/**
 	 * @brief Set object as indirect if offset != 0 or not indirect if offset == 0
@@ -116,7 +151,7 @@ namespace uPDFParser
 	bool isIndirect() {return indirectOffset != 0;}
 
 	/**
-	 * @brief Get dictionary value
+	 * @brief Get dictionary value (call update() if it's modified)
 	 */
 	DataType*& operator[](const std::string& key) { return _dictionary.value()[key]; }
 
@@ -129,8 +164,9 @@ namespace uPDFParser
 	 * @brief Remove a key in object's dictionary
 	 * No error if the key doesn't exists
 	 * Value is freed during this operation
+	 * Object is marked as updated if key was present
 	 */
-	void deleteKey(const std::string& key) { _dictionary.deleteKey(key); }
+	void deleteKey(const std::string& key);
 
 	/**
 	 * @brief is object new (or not updated) ?
@@ -138,20 +174,36 @@ namespace uPDFParser
 	bool isNew() { return _isNew; }
 
 	/**
-	 * @brief Mark object as updated
+	 * @brief Mark object as updated, it's recorded by its parser
+	 * (objects modified directly with dictionary() or data() must be updated)
 	 */
-	void update(void) { _isNew = true; }
+	void update(void);
+
+	/**
+	 * @brief Set new/updated flag (cleared once object has been written in current PDF file)
+	 */
+	void setNew(bool isNew) { _isNew = isNew; }
 
 	/**
 	 * @brief Return object's id
 	 */
 	int objectId() { return _objectId; }
 
+	/**
+	 * @brief Set object's id
+	 */
+	void setObjectId(int objectId) { _objectId = objectId; }
+
 	/**
 	 * @brief Return object's generation number
 	 */
 	int generationNumber() { return _generationNumber; }
 
+	/**
+	 * @brief Set object's generation number
+	 */
+	void setGenerationNumber(int generationNumber) { _generationNumber = generationNumber; }
+
 	/**
 	 * @brief Return object status used ('n') or free ('f')
 	 */
@@ -162,6 +214,11 @@ namespace uPDFParser
 	 */
 	void setUsed(bool used) {_used = used;}
 
+	/**
+	 * @brief Set parser that owns this object (done by parsing and Parser::addObject())
+	 */
+	void setParser(Parser* parser) {_parser = parser;}
+
 	bool operator == (const Object& other)
 	{
 	    return _objectId == other._objectId &&
@@ -171,10 +228,11 @@ namespace uPDFParser
     private:
 	int _objectId;
 	int _generationNumber;
-	off_t _offset;
+	off_t _offset, _endOffset;
 	bool _isNew;
 	off_t indirectOffset;
 	bool _used;
+	Parser* _parser;
 	Dictionary _dictionary;
 	std::vector<DataType*> _data;
     };
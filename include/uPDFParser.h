@@ -36,6 +36,93 @@
 namespace uPDFParser
 {
     class XRefValue;
+    struct ObjectRun;
+    struct SerializedRange;
+
+    /**
+     * @brief Options for a full write
+     */
+    struct WriteOptions
+    {
+	WriteOptions():
+	    xrefStream(false), threads(1), removeUnused(false),
+	    deduplicate(false), renumber(false), pageOrder(false),
+	    linearize(false), compressStreams(false), recompressStreams(false),
+	    compressionLevel(-1)
+	{}
+
+	/**
+	 * Write a cross-reference stream instead of a xref table and pack
+	 * non stream objects into (Flate compressed) object streams.
+	 * Only the last version of each object is written.
+	 */
+	bool xrefStream;
+
+	/**
+	 * Number of threads used to serialize modified objects
+	 * (0 for one per CPU core)
+	 */
+	unsigned int threads;
+
+	/**
+	 * Only write objects reachable from trailer (/Root, /Info, /Encrypt).
+	 * Ignored (all objects written) if one of them is referenced from
+	 * an object stream, as their content is not parsed.
+	 */
+	bool removeUnused;
+
+	/**
+	 * Write only one copy of identical objects (fonts, images...) and
+	 * make references point to it. References are updated in parsed objects.
+	 * Ignored for encrypted documents and when some objects are
+	 * in object streams (references inside them can't be updated).
+	 */
+	bool deduplicate;
+
+	/**
+	 * Give objects dense ids (1..n, generation 0) in write order and
+	 * update references. Parsed objects are renumbered, references to
+	 * objects not written become null and objects not written (old versions,
+	 * free or unused ones) are removed from parser (and deleted).
+	 * Ignored for the same reasons as deduplicate.
+	 */
+	bool renumber;
+
+	/**
+	 * Write catalog and page tree first, then each page followed by
+	 * the objects it uses first, then objects shared by several pages
+	 * and finally all other objects. Only last version of objects is kept.
+	 */
+	bool pageOrder;
+
+	/**
+	 * Write a linearized file (fast web view): first page and hint tables
+	 * are at the beginning of the file. Cross reference tables are always
+	 * used (xrefStream ignored). Objects are renumbered as with renumber.
+	 * Ignored for the same reasons as deduplicate or if there is no page.
+	 */
+	bool linearize;
+
+	/**
+	 * Flate compress streams without filter (if output is smaller).
+	 * /Filter and /Length are updated in parsed objects.
+	 * Metadata streams and encrypted documents are not compressed.
+	 */
+	bool compressStreams;
+
+	/**
+	 * Recompress Flate streams with compressionLevel
+	 */
+	bool recompressStreams;
+
+	/**
+	 * Flate compression level (0-9, -1 for zlib default).
+	 * Big streams are split into blocks compressed by all threads,
+	 * small ones are compressed concurrently.
+	 */
+	int compressionLevel;
+    };
+
     
     /**
      * @brief PDF Parser
@@ -45,7 +132,8 @@ namespace uPDFParser
     public:
 	Parser(int version_major=1, int version_minor=6):
 	    version_major(version_major), version_minor(version_minor),
-	    xrefObject(0), xrefOffset((off_t)-1), fd(0), curOffset(0)
+	    xrefObject(0), xrefOffset((off_t)-1), fd(0), curOffset(0),
+	    bodyOffset(0), maxObjectId(0)
 	{}
 
 	~Parser()
@@ -62,24 +150,105 @@ namespace uPDFParser
 	 */
 	void parse(const std::string& filename);
 
+	/**
+	 * @brief Parse the first page of a linearized file: the linearization
+	 * dictionary, first page cross reference table, catalog, hint stream
+	 * and first page objects. Data after first page section (/E) is not read
+	 * and may not be present yet.
+	 * Call parseRemaining() to parse the rest of the file.
+	 *
+	 * @return false if file is not linearized (nothing more than the
+	 * first object is parsed)
+	 */
+	bool parseFirstPage(const std::string& filename);
+
+	/**
+	 * @brief Parse the rest of the file opened by parseFirstPage()
+	 */
+	void parseRemaining();
+
+	/**
+	 * @brief Location of a page section (page object and objects only
+	 * used by this page) read from linearization hint tables.
+	 * Objects shared by several pages are not included.
+	 *
+	 * @param page    Page index (0 for first page)
+	 * @param offset  Offset of page section
+	 * @param length  Length of page section
+	 *
+	 * @return false if not available
+	 */
+	bool pageRange(unsigned int page, off_t& offset, off_t& length)
+	{
+	    if (page+1 >= pageOffsets.size())
+		return false;
+	    offset = pageOffsets[page];
+	    length = pageOffsets[page+1] - offset;
+	    return true;
+	}
+
 	/**
 	 * @brief Write a PDF file with internal objects
 	 *
+	 * Parsed objects modified in place (dictionary(), data(), operator[],
+	 * Stream::setData() with a buffer) must be marked with Object::update()
+	 * before writing : otherwise they're skipped by an update and their
+	 * original bytes are copied by a full write.
+	 *
 	 * @param filename File path
-	 * @param update   Only append new objects if true
-	 *                 Write a new PDF file if false (not supported for now)
+	 * @param update   Only append new objects if true. Then, filename becomes the
+	 *                 current PDF file : written objects are marked as not new
+	 *                 and next update is linked to this one
+	 *                 Write a new PDF file if false. In this case, objects
+	 *                 not marked as updated are copied verbatim from source
 	 */
 	void write(const std::string& filename, bool update=false);
 
 	/**
-	 * @brief Get internals (or parsed) objects
+	 * @brief Write a new PDF file with internal objects. As with write(),
+	 * parsed objects modified in place must be marked with Object::update().
+	 *
+	 * @param filename File path
+	 * @param options  Write options
+	 */
+	void write(const std::string& filename, const WriteOptions& options);
+
+	/**
+	 * @brief Get internals (or parsed) objects. Removed objects are not
+	 * written anymore (even if they have been updated).
 	 */
 	std::vector<Object*>& objects() { return _objects; }
 
 	/**
-	 * @brief Add an object
+	 * @brief Add an object, it will be written by next incremental update
+	 */
+	void addObject(Object* object)
+	{
+	    object->setParser(this);
+	    _objects.push_back(object);
+	    dirtyObjects.push_back(object);
+	    if (object->objectId() > maxObjectId)
+		maxObjectId = object->objectId();
+	}
+
+	/**
+	 * @brief Create and add an empty object. Its id is a freed one (with
+	 * next generation number) if there is one, else a new one. Freed
+	 * object(s) with this id are removed from parser and deleted.
+	 */
+	Object* newObject();
+
+	/**
+	 * @brief Mark object as free (only written as a free xref entry),
+	 * its id can then be reused by newObject()
+	 */
+	void freeObject(Object* object);
+
+	/**
+	 * @brief Record an added or updated object (called by Object::update())
+	 * Only recorded objects are written by incremental updates
 	 */
-	void addObject(Object* object) { _objects.push_back(object); }
+	void markDirty(Object* object) { dirtyObjects.push_back(object); }
 
 	/**
 	 * @brief Return trailer object
@@ -96,8 +265,27 @@ namespace uPDFParser
 	 * @brief Return a specific object
 	 */
 	Object* getObject(int objectId, int generationNumber=0);
+
+	/**
+	 * @brief Write a cross reference table (one subsection per range of
+	 * contiguous ids). Only the last entry of each object is kept.
+	 *
+	 * @param sink       Output
+	 * @param entries    Entries (sorted by this function)
+	 * @param fullTable  Start table at object 0, missing ids are free entries
+	 */
+	static void writeXref(Sink& sink, std::vector<XRefValue>& entries, bool fullTable);
+
+	/**
+	 * @brief Write PDF header (version and binary comment)
+	 */
+	static void writeHeader(Sink& sink, int version_major, int version_minor);
 	
     private:
+	void openFile(const std::string& filename);
+	void parseObjects(off_t end=0);
+	void endParse();
+	void readPageHints(Object* linearization);
 	void parseObject(std::string& token);
 	void parseHeader();
 	void parseStartXref();
@@ -119,35 +307,86 @@ namespace uPDFParser
 
 	void repairTrailer();
 	void writeUpdate(const std::string& filename);
+	void writeHeader(Sink& sink, int minor=0);
+	bool canCopy(Object* object);
+	void serializeObjects(std::vector<Object*>& objects, unsigned int nbThreads,
+			      std::vector<SegmentSink>& buffers, std::vector<SerializedRange>& ranges);
+	off_t writeObject(Sink& sink, Object* object, ObjectRun& run, SerializedRange* serialized=0);
+	void copyRun(Sink& sink, ObjectRun& run);
+	void writeTable(Sink& sink, std::vector<Object*>& objects, unsigned int nbThreads);
+	void writeCompressed(Sink& sink, std::vector<Object*>& objects, unsigned int nbThreads);
+	bool reachableObjects(std::vector<Object*>& objects);
+	bool canRewriteReferences(std::map<int, Object*>& latest);
+	void deduplicate(std::vector<Object*>& objects);
+	void renumber(std::vector<Object*>& objects);
+	void applyRenumbering(std::vector<Object*>& renumbered, std::map<int, Object*>& replacements,
+			      int maxId);
+	void orderByPage(std::vector<Object*>& objects);
+	bool writeLinearized(Sink& sink, std::vector<Object*>& objects);
+	void compressStreams(std::vector<Object*>& objects, const WriteOptions& options,
+			     unsigned int nbThreads);
+	void readXrefStreams(std::map<int, std::pair<int, int> >& compressed);
 
 	int version_major, version_minor;
-	std::vector<Object*> _objects;
+	std::vector<Object*> _objects, dirtyObjects;
 	Object trailer, *xrefObject;
 	off_t xrefOffset;
 	int fd;
-	off_t curOffset;
+	off_t curOffset, bodyOffset;
 	std::vector<XRefValue> _xrefTable;
+	std::vector<off_t> pageOffsets;
+	int maxObjectId;
+	std::vector<std::pair<int, int> > freeIds; // Object id, next generation number
+
+	static const unsigned int OBJECTS_PER_STREAM = 100;
+	static const int MAX_GENERATION_NUMBER = 65535;
+    };
+
+    /**
+     * @brief Range of source file copied verbatim during write
+     */
+    struct ObjectRun
+    {
+	ObjectRun():
+	    start(0), end(0), sinkOffset(0)
+	{}
+
+	off_t start, end;
+	uint64_t sinkOffset;
+    };
+
+    /**
+     * @brief Object serialized ahead of write (into buffer, between start and end)
+     */
+    struct SerializedRange
+    {
+	SerializedRange():
+	    buffer(0), start(0), end(0)
+	{}
+
+	SegmentSink* buffer;
+	uint64_t start, end;
     };
 
     class XRefValue
     {
     public:
-	XRefValue(int objectId, int offset, int generationNumber, bool used, Object* object=0):
+	XRefValue(int objectId, off_t offset, int generationNumber, bool used, Object* object=0):
 	    _objectId(objectId), _offset(offset), _generationNumber(generationNumber), _used(used),
 	    _object(object)
 	{}
 
-	int objectId() {return _objectId;}
-	int offset() {return _offset;}
-	int generationNumber() {return _generationNumber;}
-	bool used() {return _used;}
+	int objectId() const {return _objectId;}
+	off_t offset() const {return _offset;}
+	int generationNumber() const {return _generationNumber;}
+	bool used() const {return _used;}
 	
 	void setObject(Object* object) { _object = object; }
 	Object* object() { return _object; }
 	
     private:
 	int _objectId;
-	int _offset;
+	off_t _offset;
 	int _generationNumber;
 	bool _used;
 	Object* _object;
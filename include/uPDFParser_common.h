@@ -22,8 +22,9 @@ namespace uPDFParser
 	INVALID_OBJECT,
 	INVALID_TRAILER,
 	INVALID_HEXASTRING,
-	NOT_IMPLEMENTED
-	
+	NOT_IMPLEMENTED,
+	UNABLE_TO_WRITE_FILE
+
     };
 
     /**
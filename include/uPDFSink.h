@@ -0,0 +1,296 @@
+/*
+  Copyright 2021 Grégory Soutadé
+
+  This file is part of uPDFParser.
+
+  uPDFParser is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  uPDFParser is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with uPDFParser. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _UPDFSINK_HPP_
+#define _UPDFSINK_HPP_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <charconv>
+#include <functional>
+
+namespace uPDFParser
+{
+    /**
+     * @brief pread() that handles partial reads (and reads bigger than
+     * what the kernel returns at once), raise an exception on EOF
+     */
+    void readFully(int fd, char* buffer, size_t length, uint64_t offset);
+
+    /**
+     * @brief Output where serialized data is appended
+     */
+    class Sink
+    {
+    public:
+	/**
+	 * @brief Data reader : fills at most size bytes of buffer with data
+	 * starting at offset and returns the number of bytes filled
+	 */
+	typedef std::function<size_t(char* buffer, size_t size, uint64_t offset)> Reader;
+
+	Sink():
+	    _offset(0), _last('\0')
+	{}
+
+	virtual ~Sink() {}
+
+	/**
+	 * @brief Append data at the end of sink
+	 */
+	void append(const char* data, size_t length)
+	{
+	    if (!length) return;
+	    writeData(data, length);
+	    _offset += length;
+	    _last = data[length-1];
+	}
+
+	void append(const char* data) { append(data, strlen(data)); }
+	void append(const std::string& data) { append(data.c_str(), data.size()); }
+	void append(char c) { append(&c, 1); }
+
+	/**
+	 * @brief Append decimal representation of value (no allocation)
+	 */
+	void appendInteger(int64_t value)
+	{
+	    char buffer[24];
+	    std::to_chars_result res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	    append(buffer, res.ptr - buffer);
+	}
+
+	/**
+	 * @brief Append a part of another file
+	 *
+	 * @param fd      Source file descriptor (not modified)
+	 * @param offset  Offset of data in fd
+	 * @param length  Length of data to copy
+	 */
+	void copyFrom(int fd, uint64_t offset, uint64_t length)
+	{
+	    if (!length) return;
+	    copyData(fd, offset, length);
+	    _offset += length;
+	}
+
+	/**
+	 * @brief Append length bytes given by reader, read sequentially
+	 * from offset 0. Reader must stay valid until sink is replayed
+	 * (SegmentSink only records it).
+	 */
+	void appendFrom(const Reader& reader, uint64_t length)
+	{
+	    if (!length) return;
+	    readData(reader, length);
+	    _offset += length;
+	}
+
+	/**
+	 * @brief Number of bytes appended since sink creation
+	 */
+	uint64_t offset() { return _offset; }
+
+	/**
+	 * @brief Last character appended ('\0' if none)
+	 */
+	char last() { return _last; }
+
+    protected:
+	/**
+	 * @brief Really write data (implemented by subclasses)
+	 */
+	virtual void writeData(const char* data, size_t length) = 0;
+
+	/**
+	 * @brief Copy data from fd, default implementation reads it
+	 * by blocks and calls writeData(). _last must be updated.
+	 */
+	virtual void copyData(int fd, uint64_t offset, uint64_t length);
+
+	/**
+	 * @brief Read data from reader, default implementation reads it
+	 * by blocks and calls writeData(). _last must be updated.
+	 */
+	virtual void readData(const Reader& reader, uint64_t length);
+
+	uint64_t _offset;
+	char _last;
+    };
+
+    /**
+     * @brief Sink that appends data into a caller supplied std::string
+     */
+    class StringSink : public Sink
+    {
+    public:
+	StringSink(std::string& buffer):
+	    buffer(buffer)
+	{}
+
+    protected:
+	virtual void writeData(const char* data, size_t length) { buffer.append(data, length); }
+
+    private:
+	std::string& buffer;
+    };
+
+    /**
+     * @brief Sink that only computes a hash (64 bits FNV-1a) of appended data
+     */
+    class HashSink : public Sink
+    {
+    public:
+	HashSink():
+	    _hash(FNV_OFFSET_BASIS)
+	{}
+
+	uint64_t hash() { return _hash; }
+
+    protected:
+	virtual void writeData(const char* data, size_t length)
+	{
+	    for (size_t i=0; i<length; i++)
+		_hash = (_hash ^ (unsigned char)data[i]) * FNV_PRIME;
+	}
+
+    private:
+	static const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+	static const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+	uint64_t _hash;
+    };
+
+    /**
+     * @brief In memory sink where copies from other files and readers are
+     * only recorded, data is really read when sink is replayed into another
+     * one. last() is unknown ('\0') after appendFrom().
+     */
+    class SegmentSink : public Sink
+    {
+    public:
+	/**
+	 * @brief Append part of sink (between offset from and to) into another sink
+	 */
+	void replay(Sink& sink, uint64_t from, uint64_t to);
+
+    protected:
+	virtual void writeData(const char* data, size_t length);
+	virtual void copyData(int fd, uint64_t offset, uint64_t length);
+	virtual void readData(const Reader& reader, uint64_t length);
+
+    private:
+	struct Segment
+	{
+	    uint64_t offset;      // Offset in sink
+	    int fd;               // 0 for data in buffer or reader
+	    uint64_t dataOffset;  // Offset in buffer or in fd
+	    uint64_t length;
+	    Reader reader;        // Empty for data in buffer or fd
+	};
+
+	std::string buffer;
+	std::vector<Segment> segments;
+    };
+
+    /**
+     * @brief Sink that compares appended data with the content of a
+     * SegmentSink, block by block, without keeping it in memory
+     */
+    class CompareSink : public Sink
+    {
+    public:
+	CompareSink(SegmentSink& reference):
+	    reference(reference), position(0), _equal(true)
+	{}
+
+	/**
+	 * @brief Return true if all data appended equals reference content
+	 */
+	bool equal() { return _equal && position == reference.offset(); }
+
+    protected:
+	virtual void writeData(const char* data, size_t length);
+	virtual void copyData(int fd, uint64_t offset, uint64_t length);
+	virtual void readData(const Reader& reader, uint64_t length);
+
+    private:
+	static const size_t COMPARE_SIZE = 64*1024;
+
+	SegmentSink& reference;
+	std::string block;
+	uint64_t position;
+	bool _equal;
+    };
+
+    /**
+     * @brief Buffered sink that writes into a file descriptor
+     * Data is flushed by large blocks, offset is computed internally
+     * (no lseek needed). flush() must be called before closing fd.
+     * Big copies from another file are done by the kernel
+     * (copy_file_range/sendfile) when available.
+     */
+    class FileSink : public Sink
+    {
+    public:
+	/**
+	 * @brief FileSink constructor
+	 *
+	 * @param fd          Output file descriptor
+	 * @param offset      Current offset of fd
+	 * @param bufferSize  Size of internal buffer
+	 */
+	FileSink(int fd, uint64_t offset=0, size_t bufferSize=1024*1024);
+	~FileSink();
+
+	/**
+	 * @brief Write buffered data into fd
+	 */
+	void flush();
+
+	/**
+	 * @brief Copy the beginning of another file into an empty output.
+	 * Destination is a reflink of source if filesystem supports it, else
+	 * it's preallocated and filled by the kernel (or by copyFrom()).
+	 *
+	 * @param fd      Source file descriptor
+	 * @param length  Number of bytes to copy
+	 */
+	void copyFile(int fd, uint64_t length);
+
+    protected:
+	virtual void writeData(const char* data, size_t length);
+	virtual void copyData(int fd, uint64_t offset, uint64_t length);
+
+    private:
+	void writeFully(struct iovec* iov, int iovcnt);
+
+	// Under this size, data is copied into buffer
+	static const uint64_t KERNEL_COPY_THRESHOLD = 64*1024;
+
+	int fd;
+	char* buffer;
+	size_t bufferSize, used;
+    };
+}
+
+#endif
@@ -25,25 +25,15 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <functional>
+#include <sys/types.h>
 
-static std::string strReplace(const std::string& orig, const std::string& pattern, const std::string subst)
-{
-    std::string res = orig;
-    std::size_t pos;
-    
-    do
-    {
-	pos = res.find(pattern);
-
-	if (pos != std::string::npos)
-	    res.replace(pos, pattern.size(), subst);
-    } while (pos != std::string::npos);
-
-    return res;
-}
+#include "uPDFSink.h"
 
 namespace uPDFParser
 {
+    class Object;
+
     /**
      * @brief Base class for PDF object type
      * From https://resources.infosecinstitute.com/topic/pdf-file-format-basic-structure/
@@ -67,7 +57,18 @@ namespace uPDFParser
 	/**
 	 * @brief String representation for serialization
 	 */
-	virtual std::string str() = 0;
+	virtual std::string str()
+	{
+	    std::string res;
+	    StringSink sink(res);
+	    serialize(sink);
+	    return res;
+	}
+
+	/**
+	 * @brief Append serialized representation into sink
+	 */
+	virtual void serialize(Sink& sink) = 0;
 
 	/**
 	 * @brief Clone current object
@@ -87,7 +88,7 @@ namespace uPDFParser
 
 	virtual DataType* clone() {return new Boolean(_value);}
 	bool value() {return _value;}
-	virtual std::string str() { return (_value)?" true":" false";}
+	virtual void serialize(Sink& sink) { sink.append((_value)?" true":" false");}
 	
     private:
 	bool _value;
@@ -96,32 +97,32 @@ namespace uPDFParser
     class Integer : public DataType
     {
     public:
-	Integer(int value, bool _signed=false):
+	Integer(int64_t value, bool _signed=false):
 	    DataType(DataType::TYPE::INTEGER), _value(value), _signed(_signed)
 	{}
 
 	virtual DataType* clone() {return new Integer(_value, _signed);}
-	int value() {return _value;}
-	virtual std::string str();
+	int64_t value() {return _value;}
+	virtual void serialize(Sink& sink);
 
     private:
-	int _value;
+	int64_t _value;
 	bool _signed;
     };
     
     class Real : public DataType
     {
     public:
-	Real(float value, bool _signed=false):
+	Real(double value, bool _signed=false):
 	    DataType(DataType::TYPE::REAL), _value(value), _signed(_signed)
 	{}
 
 	virtual DataType* clone() {return new Real(_value, _signed);}
-	float value() {return _value;}
-	virtual std::string str();
+	double value() {return _value;}
+	virtual void serialize(Sink& sink);
 	
     private:
-	float _value;
+	double _value;
 	bool _signed;
     };
 
@@ -136,6 +137,7 @@ namespace uPDFParser
 	    return std::string(&name[1]);
 	}
 	virtual std::string str() { return _value;}
+	virtual void serialize(Sink& sink) { sink.append(_value);}
 	
     private:
 	std::string _value;
@@ -144,43 +146,33 @@ namespace uPDFParser
     class String : public DataType
     {
     public:
-	String(const std::string&);
+	/**
+	 * @brief Literal string
+	 *
+	 * @param value       Raw value (escapes not decoded)
+	 * @param hasEscapes  Value contains '\\' or carriage returns (to be decoded)
+	 */
+	String(const std::string& value, bool hasEscapes=true);
 
-	virtual DataType* clone() {return new String(_value);}
+	virtual DataType* clone() {return new String(_value, _hasEscapes);}
 	std::string value() {return _value;}
+	bool hasEscapes() {return _hasEscapes;}
 
-	// Escape '(' and ')' characters
-	virtual std::string str() {
-	    char prev = '\0';
-	    std::string res("(");
-
-	    for(unsigned int i=0; i<_value.size(); i++)
-	    {
-		if ((_value[i] == '(' || _value[i] == ')') &&
-		    prev != '\\')
-		    res += '\\';
-		res += _value[i];
-		prev = _value[i];
-	    }
-
-	    res += ")";
-	    return res;
-	}
-
-	// Remove escape character '\'
-	virtual std::string unescapedValue() {
-	    // Unescape '\n', \r', '\', '(' and ')'
-	    std::string res = strReplace(_value, "\\\\", "\\");
-	    res = strReplace(res, "\\(", "(");
-	    res = strReplace(res, "\\)", ")");
-	    res = strReplace(res, "\\n", "\n");
-	    res = strReplace(res, "\\r", "\r");
+	/**
+	 * @brief Write decoded value as a literal string (parenthesis, backslashes
+	 * and control characters escaped) or as an hexadecimal string if smaller
+	 */
+	virtual void serialize(Sink& sink);
 
-	    return res;
-	}
+	/**
+	 * @brief Decoded value : escape sequences (including octal ones and
+	 * line continuations) are decoded and end of lines become '\n'
+	 */
+	virtual std::string unescapedValue();
 
     private:
 	std::string _value;
+	bool _hasEscapes;
     };
 
     class HexaString : public DataType
@@ -190,7 +182,11 @@ namespace uPDFParser
 
 	virtual DataType* clone() {return new HexaString(_value);}
 	std::string value() {return _value;}
-	virtual std::string str() { return std::string("<") + _value + std::string(">");}
+	virtual void serialize(Sink& sink) {
+	    sink.append('<');
+	    sink.append(_value);
+	    sink.append('>');
+	}
 
     private:
 	std::string _value;
@@ -205,10 +201,17 @@ namespace uPDFParser
 	
 	virtual DataType* clone() {return new Reference(objectId, generationNumber);}
 	int value() {return objectId;}
-	virtual std::string str() {
-	    std::stringstream res;
-	    res << " " << objectId << " " << generationNumber << " R";
-	    return res.str();
+	int generation() {return generationNumber;}
+	void setValue(int objectId, int generationNumber) {
+	    this->objectId = objectId;
+	    this->generationNumber = generationNumber;
+	}
+	virtual void serialize(Sink& sink) {
+	    sink.append(' ');
+	    sink.appendInteger(objectId);
+	    sink.append(' ');
+	    sink.appendInteger(generationNumber);
+	    sink.append(" R");
 	}
 
     private:
@@ -232,7 +235,7 @@ namespace uPDFParser
 	    return res;
 	}
 	std::vector<DataType*>& value() {return _value;}
-	virtual std::string str();
+	virtual void serialize(Sink& sink);
 
     private:
 	std::vector<DataType*> _value;
@@ -257,7 +260,7 @@ namespace uPDFParser
 	    return res;
 	}
 	std::map<std::string, DataType*>& value() {return _value;}
-	virtual std::string str();
+	virtual void serialize(Sink& sink);
 
 	bool empty() { return _value.empty(); }
 
@@ -289,31 +292,92 @@ namespace uPDFParser
     class Stream : public DataType
     {
     public:
-	Stream(Dictionary& dict, int startOffset, int endOffset, unsigned char* data=0, unsigned int dataLength=0,
+	Stream(Dictionary& dict, off_t startOffset, off_t endOffset, unsigned char* data=0, size_t dataLength=0,
 	       bool freeData=false, int fd=0):
-	    DataType(DataType::TYPE::STREAM), dict(dict), fd(fd),
+	    DataType(DataType::TYPE::STREAM), dict(&dict), owner(0), fd(fd),
 	    startOffset(startOffset), endOffset(endOffset),
-	    _data(data), _dataLength(dataLength), freeData(false)
+	    _data(data), _dataLength(dataLength), freeData(freeData),
+	    ownFd(false)
 	{}
 
 	~Stream() {
-	    if (_data && freeData) delete[] _data;
+	    releaseData();
 	}
 	
-	virtual DataType* clone() {return new Stream(dict, startOffset, endOffset,
-						     _data, _dataLength, false, fd);}
-	virtual std::string str();
+	/**
+	 * @brief Data generator : fills at most size bytes of buffer with data
+	 * starting at offset and returns the number of bytes filled
+	 */
+	typedef std::function<size_t(unsigned char* buffer, size_t size, size_t offset)> Generator;
+
+	virtual DataType* clone();
+	virtual void serialize(Sink& sink);
+
+	/**
+	 * @brief Set object containing this stream: /Length is updated into
+	 * its dictionary and it's marked as updated when data is replaced
+	 * (done by parsing and Object copy)
+	 */
+	void setOwner(Object* owner);
+
+	/**
+	 * @brief Return data, read (or generated) once and kept in memory
+	 */
 	unsigned char* data();
-	unsigned int dataLength() {return _dataLength;}
-	void setData(unsigned char* data, unsigned int dataLength, bool freeData=false);
+
+	/**
+	 * @brief Copy data into res without keeping it in memory
+	 */
+	void readData(std::string& res);
+
+	size_t dataLength() {
+	    // Not read yet
+	    if (!_data && !generator && fd)
+		return endOffset - startOffset;
+	    return _dataLength;
+	}
+	/**
+	 * @brief Replace data by a buffer. /Length is not updated and
+	 * object containing stream must be updated by caller.
+	 */
+	void setData(unsigned char* data, size_t dataLength, bool freeData=false);
+
+	/**
+	 * @brief Replace data by a part of a file, read only when stream
+	 * is written (fd must stay opened). /Length is updated and owner
+	 * is marked as updated.
+	 */
+	void setData(int fd, off_t offset, size_t length);
+
+	/**
+	 * @brief Replace data by a file content. File is opened now (and closed
+	 * with stream), but read only when stream is written. /Length is updated and
+	 * owner is marked as updated.
+	 */
+	void setData(const std::string& filename);
+
+	/**
+	 * @brief Replace data by a generator called each time stream is
+	 * serialized (write, deduplication, str()...). Each serialization
+	 * restarts from offset 0 and reads data sequentially, so generator must
+	 * be able to provide the same data several times. It must provide
+	 * exactly length bytes. /Length is updated and owner is marked as updated.
+	 */
+	void setData(const Generator& generator, size_t length);
 
     private:
-	Dictionary& dict;
+	void releaseData();
+	void readInto(unsigned char* buffer);
+	void setLength(size_t length);
+
+	Dictionary* dict;
+	Object* owner;
 	int fd;
-	int startOffset, endOffset;
+	off_t startOffset, endOffset;
 	unsigned char* _data;
-	unsigned int _dataLength;
-	bool freeData;
+	size_t _dataLength;
+	bool freeData, ownFd;
+	Generator generator;
     };
 
     class Null : public DataType
@@ -325,7 +389,7 @@ namespace uPDFParser
 
 	virtual DataType* clone() {return new Null();}
 	bool value() {return 0;}
-	virtual std::string str() { return "null";}
+	virtual void serialize(Sink& sink) { sink.append("null");}
 	
     private:
     };
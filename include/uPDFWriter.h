@@ -0,0 +1,87 @@
+/*
+  Copyright 2021 Grégory Soutadé
+
+  This file is part of uPDFParser.
+
+  uPDFParser is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  uPDFParser is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with uPDFParser. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _UPDFWRITER_HPP_
+#define _UPDFWRITER_HPP_
+
+#include <string>
+#include <vector>
+#include <set>
+#include <stdint.h>
+
+#include "uPDFTypes.h"
+#include "uPDFObject.h"
+#include "uPDFSink.h"
+
+namespace uPDFParser
+{
+    /**
+     * @brief Append only PDF writer: objects are written as soon as they're
+     * finished and only their offset is kept in memory.
+     * Forward references are done with reserved ids.
+     */
+    class Writer
+    {
+    public:
+	/**
+	 * @brief Create a new PDF file and write its header
+	 *
+	 * @param filename       File path
+	 * @param version_major  PDF major version
+	 * @param version_minor  PDF minor version
+	 */
+	Writer(const std::string& filename, int version_major=1, int version_minor=6);
+	~Writer();
+
+	/**
+	 * @brief Reserve an object id, object must be written before close()
+	 */
+	int reserve();
+
+	/**
+	 * @brief Write an object (generation number is always 0).
+	 * A new id is given to objects with id 0. Object is not
+	 * referenced by writer and can be freed after this call.
+	 *
+	 * @return object's id
+	 */
+	int write(Object& object);
+
+	/**
+	 * @brief Trailer dictionary (Root, Info, ID...), Size is added by close()
+	 */
+	Dictionary& trailer() { return _trailer; }
+
+	/**
+	 * @brief Write cross reference table and trailer, then close file.
+	 * Ids neither reserved nor written are free entries.
+	 */
+	void close();
+
+    private:
+	int fd;
+	FileSink* sink;
+	std::vector<uint64_t> offsets; // Offset of each object id, 0 if not written
+	std::set<int> reserved;        // Reserved ids not written yet
+	Dictionary _trailer;
+    };
+}
+
+#endif
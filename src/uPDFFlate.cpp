@@ -0,0 +1,219 @@
+/*
+  Copyright 2021 Grégory Soutadé
+
+  This file is part of uPDFParser.
+
+  uPDFParser is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  uPDFParser is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with uPDFParser. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "uPDFFlate.h"
+#include "uPDFParser_common.h"
+
+namespace uPDFParser
+{
+    const size_t Flate::BLOCK_SIZE;
+
+#ifdef HAVE_ZLIB
+    bool Flate::available() { return true; }
+
+    bool Flate::compress(const unsigned char* data, size_t length, std::string& res, int level)
+    {
+	size_t prevSize = res.size();
+	uLongf outLength = compressBound(length);
+
+	res.resize(prevSize + outLength);
+
+	int ret = compress2((Bytef*)&res[prevSize], &outLength, data, length, level);
+	if (ret != Z_OK)
+	    EXCEPTION(INVALID_STREAM, "Unable to compress data (" << ret << ")");
+
+	res.resize(prevSize + outLength);
+
+	return true;
+    }
+
+    // Deflate window size
+    static const size_t DICTIONARY_SIZE = 32*1024;
+
+    /**
+     * @brief Raw deflate of a block, dictLength bytes before data are used
+     * as dictionary. Non final blocks end on a byte boundary (sync flush).
+     */
+    static int deflateBlock(const unsigned char* data, size_t length, size_t dictLength,
+			    bool last, int level, std::string& res)
+    {
+	z_stream stream;
+	int ret;
+
+	memset(&stream, 0, sizeof(stream));
+	ret = deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	if (ret != Z_OK)
+	    return ret;
+
+	if (dictLength)
+	    ret = deflateSetDictionary(&stream, data - dictLength, dictLength);
+
+	if (ret == Z_OK)
+	{
+	    // Sync flush adds an empty stored block
+	    res.resize(deflateBound(&stream, length) + 16);
+
+	    stream.next_in = (Bytef*)data;
+	    stream.avail_in = length;
+	    stream.next_out = (Bytef*)&res[0];
+	    stream.avail_out = res.size();
+
+	    ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+
+	    if (ret == (last ? Z_STREAM_END : Z_OK) && !stream.avail_in)
+	    {
+		res.resize(stream.total_out);
+		ret = Z_OK;
+	    }
+	    else if (ret >= Z_OK)
+		ret = Z_BUF_ERROR;
+	}
+
+	deflateEnd(&stream);
+
+	return ret;
+    }
+
+    bool Flate::compress(const unsigned char* data, size_t length, std::string& res,
+			 int level, unsigned int nbThreads)
+    {
+	size_t nbBlocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	if (nbThreads <= 1 || nbBlocks <= 1)
+	    return compress(data, length, res, level);
+
+	std::vector<std::string> blocks(nbBlocks);
+	std::vector<uLong> checksums(nbBlocks);
+	std::vector<int> errors(nbBlocks, Z_OK);
+	std::vector<std::thread> threads;
+	std::atomic<size_t> nextBlock(0);
+
+	nbThreads = std::min((size_t)nbThreads, nbBlocks);
+
+	for (unsigned int i=0; i<nbThreads; i++)
+	{
+	    threads.push_back(std::thread([&]() {
+		size_t block;
+		while ((block = nextBlock++) < nbBlocks)
+		{
+		    size_t offset = block * BLOCK_SIZE;
+		    size_t blockLength = std::min(BLOCK_SIZE, length - offset);
+
+		    errors[block] = deflateBlock(&data[offset], blockLength,
+						 std::min(offset, DICTIONARY_SIZE),
+						 block == nbBlocks-1, level, blocks[block]);
+		    checksums[block] = adler32(adler32(0, Z_NULL, 0), &data[offset], blockLength);
+		}
+	    }));
+	}
+
+	for (unsigned int i=0; i<nbThreads; i++)
+	    threads[i].join();
+
+	for (size_t i=0; i<nbBlocks; i++)
+	{
+	    if (errors[i] != Z_OK)
+		EXCEPTION(INVALID_STREAM, "Unable to compress data (" << errors[i] << ")");
+	}
+
+	// zlib header : deflate with 32KB window, level hint, no dictionary
+	int levelHint = 2;
+	if (level >= 0 && level <= 1) levelHint = 0;
+	else if (level >= 2 && level <= 5) levelHint = 1;
+	else if (level >= 7) levelHint = 3;
+
+	unsigned char cmf = 0x78;
+	unsigned char flg = levelHint << 6;
+	flg += 31 - ((cmf << 8) + flg) % 31;
+
+	res += (char)cmf;
+	res += (char)flg;
+
+	uLong checksum = adler32(0, Z_NULL, 0);
+	for (size_t i=0; i<nbBlocks; i++)
+	{
+	    size_t blockLength = std::min(BLOCK_SIZE, length - i * BLOCK_SIZE);
+	    res += blocks[i];
+	    checksum = adler32_combine(checksum, checksums[i], blockLength);
+	}
+
+	for (int i=3; i>=0; i--)
+	    res += (char)((checksum >> (i*8)) & 0xFF);
+
+	return true;
+    }
+
+    void Flate::decompress(const unsigned char* data, size_t length, std::string& res)
+    {
+	z_stream stream;
+	unsigned char buffer[64*1024];
+	int ret;
+
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit(&stream) != Z_OK)
+	    EXCEPTION(INVALID_STREAM, "Unable to init zlib");
+
+	stream.next_in = (Bytef*)data;
+	stream.avail_in = length;
+
+	do
+	{
+	    stream.next_out = buffer;
+	    stream.avail_out = sizeof(buffer);
+
+	    ret = inflate(&stream, Z_NO_FLUSH);
+
+	    if (ret != Z_OK && ret != Z_STREAM_END)
+	    {
+		inflateEnd(&stream);
+		EXCEPTION(INVALID_STREAM, "Invalid Flate data (" << ret << ")");
+	    }
+
+	    res.append((const char*)buffer, sizeof(buffer) - stream.avail_out);
+	} while (ret != Z_STREAM_END && (stream.avail_in || !stream.avail_out));
+
+	inflateEnd(&stream);
+    }
+#else
+    bool Flate::available() { return false; }
+
+    bool Flate::compress(const unsigned char*, size_t, std::string&, int)
+    {
+	return false;
+    }
+
+    bool Flate::compress(const unsigned char*, size_t, std::string&, int, unsigned int)
+    {
+	return false;
+    }
+
+    void Flate::decompress(const unsigned char*, size_t, std::string&)
+    {
+	EXCEPTION(NOT_IMPLEMENTED, "Flate support not compiled");
+    }
+#endif
+}
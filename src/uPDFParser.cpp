@@ -23,29 +23,73 @@
 #include <unistd.h>
 #include <string>
 #include <cstring>
+#include <algorithm>
+#include <set>
+#include <functional>
+#include <thread>
+#include <exception>
+#include <tuple>
+#include <charconv>
+#include <stdexcept>
 
 #include "uPDFParser.h"
 #include "uPDFParser_common.h"
+#include "uPDFFlate.h"
 
 namespace uPDFParser
 {
+    void Object::update(void)
+    {
+	if (!_isNew && _parser)
+	    _parser->markDirty(this);
+	_isNew = true;
+    }
+
+    void Object::deleteKey(const std::string& key)
+    {
+	if (!_dictionary.hasKey(key))
+	    return;
+
+	_dictionary.deleteKey(key);
+	update();
+    }
+
     std::string Object::str()
     {
-	std::stringstream res;
+	std::string res;
+	StringSink sink(res);
+	serialize(sink);
+	return res;
+    }
+
+    void Object::serialize(Sink& sink)
+    {
+	sink.appendInteger(_objectId);
+	sink.append(' ');
+	sink.appendInteger(_generationNumber);
+	sink.append(" obj\n");
+	serializeContent(sink);
+	sink.append("endobj\n");
+    }
 
-	res << _objectId << " " << _generationNumber << " obj\n";
+    void Object::serializeContent(Sink& sink)
+    {
 	if (isIndirect())
-	    res << "   " << indirectOffset << "\n";
+	{
+	    sink.append("   ");
+	    sink.appendInteger(indirectOffset);
+	    sink.append('\n');
+	}
 	else
 	{
 	    bool needLineReturn = false;
 	    
 	    if (!_dictionary.empty())
-		res << _dictionary.str();
+		_dictionary.serialize(sink);
 	    else
 	    {
 		if (!_data.size())
-		    res << "<<>>\n";
+		    sink.append("<<>>\n");
 		else
 		    needLineReturn = true;
 	    }
@@ -53,41 +97,49 @@ namespace uPDFParser
 	    std::vector<DataType*>::iterator it;
 	    for(it=_data.begin(); it!=_data.end(); it++)
 	    {
-		std::string tmp = (*it)->str();
-		res << tmp;
-		if (tmp[tmp.size()-1] == '\n' ||
-		    tmp[tmp.size()-1] == '\r')
+		(*it)->serialize(sink);
+		if (sink.last() == '\n' ||
+		    sink.last() == '\r')
 		    needLineReturn = false;
 	    }
 
 	    if (needLineReturn)
-		res << "\n";
+		sink.append('\n');
 	}
-
-	res << "endobj\n";
-
-	return res.str();
     }
 
     static DataType* tokenToNumber(std::string& token, char sign='\0')
     {
 	int i;
-	float fvalue;
-	int ivalue;
+	double fvalue;
+	int64_t ivalue;
+	std::from_chars_result res;
+	const char* end = token.c_str() + token.size();
 	
+	// from_chars() doesn't depend on locale (decimal point). Errors are
+	// reported as std::stod()/std::stoll() do (callers rely on them)
 	for(i=0; i<(int)token.size(); i++)
 	{
 	    if (token[i] == '.')
 	    {
 		if (i==0) token = std::string("0") + token;
-		fvalue = std::stof(token);
+		end = token.c_str() + token.size();
+		res = std::from_chars(token.c_str(), end, fvalue, std::chars_format::fixed);
+		if (res.ec == std::errc::invalid_argument)
+		    throw std::invalid_argument("Invalid real " + token);
+		if (res.ec != std::errc())
+		    throw std::out_of_range("Invalid real " + token);
 		if (sign == '-')
 		    fvalue = -fvalue;
 		return new Real(fvalue, (sign!='\0'));
 	    }
 	}
 
-	ivalue = std::stoi(token);
+	res = std::from_chars(token.c_str(), end, ivalue);
+	if (res.ec == std::errc::invalid_argument)
+	    throw std::invalid_argument("Invalid integer " + token);
+	if (res.ec != std::errc())
+	    throw std::out_of_range("Invalid integer " + token);
 	if (sign == '-')
 	    ivalue = -ivalue;
 	
@@ -391,7 +443,7 @@ namespace uPDFParser
 	    if (tokens[0].length() == 10)
 	    {
 		tokens[2] = nextToken();
-		XRefValue xref(curId, std::stoi(tokens[0],0,10), std::stoi(tokens[1],0,10),
+		XRefValue xref(curId, std::stoll(tokens[0],0,10), std::stoi(tokens[1],0,10),
 			       (tokens[2] == "n") ? true : false);
 		_xrefTable.push_back(xref);
 		curId++;
@@ -521,7 +573,7 @@ namespace uPDFParser
     {
 	std::string res("");
 	char c;
-	bool escaped = false;
+	bool escaped = false, hasEscapes = false;
 	int parenthesis_count = 1; /* Handle parenthesis in parenthesis */
 	
 	while (1)
@@ -543,10 +595,13 @@ namespace uPDFParser
 	    else
 		escaped = (c == '\\');
 
+	    if (c == '\\' || c == '\r')
+		hasEscapes = true;
+
 	    res += c;
 	}
 
-	return new String(res);
+	return new String(res, hasEscapes);
     }
     
     HexaString* Parser::parseHexaString()
@@ -592,8 +647,12 @@ namespace uPDFParser
 	    token = nextToken();
 
 	    if (token == "endstream")
-		return new Stream(object->dictionary(), startOffset, endOffset,
-				  0, 0, false, fd);
+	    {
+		Stream* stream = new Stream(object->dictionary(), startOffset, endOffset,
+					    0, 0, false, fd);
+		stream->setOwner(object);
+		return stream;
+	    }
 
 	    // No endstream, come back at the begining
 	    lseek(fd, startOffset, SEEK_SET);
@@ -629,8 +688,10 @@ namespace uPDFParser
 	    }
 	}
 	
-	return new Stream(object->dictionary(), startOffset, endOffset,
-			  0, 0, false, fd);
+	Stream* stream = new Stream(object->dictionary(), startOffset, endOffset,
+				    0, 0, false, fd);
+	stream->setOwner(object);
+	return stream;
     }
     
     Name* Parser::parseName(std::string& name)
@@ -694,7 +755,10 @@ namespace uPDFParser
 	// std::cout << "New obj " << objectId << " " << generationNumber << std::endl;
 	
 	object = new Object(objectId, generationNumber, offset);
+	object->setParser(this);
 	_objects.push_back(object);
+	if (objectId > maxObjectId)
+	    maxObjectId = objectId;
 	std::vector<DataType*>& datas = object->data();
 	
 	while (1)
@@ -702,7 +766,10 @@ namespace uPDFParser
 	    token = nextToken();
 
 	    if (token == "endobj")
+	    {
+		object->setEndOffset(lseek(fd, 0, SEEK_CUR));
 		break;
+	    }
 
 	    if (token == "<<")
 		parseDictionary(object, object->dictionary().value());
@@ -725,11 +792,17 @@ namespace uPDFParser
 	    xrefObject = object;
     }
 
-    void Parser::parse(const std::string& filename)
+    static int64_t getInteger(Dictionary& dict, const std::string& key, int64_t defaultValue)
+    {
+	if (!dict.hasKey(key) || !dict.value()[key] ||
+	    dict.value()[key]->type() != DataType::TYPE::INTEGER)
+	    return defaultValue;
+
+	return ((Integer*)dict.value()[key])->value();
+    }
+
+    void Parser::openFile(const std::string& filename)
     {
-	std::string token;
-	bool secondLine = true;
-	
 	if (fd)
 	    close(fd);
 
@@ -739,6 +812,8 @@ namespace uPDFParser
 	    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to open " << filename << " (%m)");
 
 	parseHeader();
+	bodyOffset = curOffset;
+	pageOffsets.clear();
 	
 	// // Check %%EOF at then end
 	// lseek(fd, -5, SEEK_END);
@@ -747,6 +822,13 @@ namespace uPDFParser
 	//     EXCEPTION(INVALID_FOOTER, "Invalid PDF footer");
 
 	lseek(fd, curOffset, SEEK_SET);
+    }
+
+    void Parser::parseObjects(off_t end)
+    {
+	std::string token;
+	bool secondLine = (curOffset == bodyOffset);
+	Object* prevObject = 0, *lastObject;
 
 	while (1)
 	{
@@ -755,10 +837,26 @@ namespace uPDFParser
 	    if (!token.size())
 		break;
 
+	    // Next token will be read again by next call
+	    if (end && curOffset >= end)
+	    {
+		lseek(fd, curOffset, SEEK_SET);
+		break;
+	    }
+
+	    lastObject = prevObject;
+	    prevObject = 0;
+
 	    if (token == "xref")
 		parseXref();
 	    else if (token[0] >= '1' && token[0] <= '9')
+	    {
+		// Only blanks between two objects : make source ranges contiguous
+		if (lastObject)
+		    lastObject->setEndOffset(curOffset);
 		parseObject(token);
+		prevObject = _objects.back();
+	    }
 	    // Can have startxref without trailer (not end of document)
 	    else if (token == "startxref")
 		parseStartXref();
@@ -775,9 +873,13 @@ namespace uPDFParser
 	    // If for optimization
 	    if (secondLine) secondLine = false;
 	}
+    }
 
+    void Parser::endParse()
+    {
 	// Synchronize xref table with parsed objects
 	std::vector<XRefValue>::iterator it;
+	std::map<int, XRefValue*> lastEntries;
 	for (it=_xrefTable.begin(); it != _xrefTable.end(); it++)
 	{
 	    Object* object = getObject((*it).objectId(), (*it).generationNumber());
@@ -786,9 +888,97 @@ namespace uPDFParser
 		(*it).setObject(object);
 		object->setUsed((*it).used());
 	    }
+	    lastEntries[(*it).objectId()] = &(*it);
 	}
 
 	repairTrailer();
+
+	// Ids of objects stored in object streams are only covered by Size
+	int size = getInteger(trailer.dictionary(), "Size", 0);
+	if (size - 1 > maxObjectId)
+	    maxObjectId = size - 1;
+	if (!lastEntries.empty() && lastEntries.rbegin()->first > maxObjectId)
+	    maxObjectId = lastEntries.rbegin()->first;
+
+	// Free entries can be reused, except if an object uses them
+	std::set<int> usedIds;
+	std::vector<Object*>::iterator oit;
+	for (oit=_objects.begin(); oit!=_objects.end(); oit++)
+	{
+	    if ((*oit)->used())
+		usedIds.insert((*oit)->objectId());
+	}
+
+	freeIds.clear();
+	std::map<int, XRefValue*>::reverse_iterator entry;
+	for (entry=lastEntries.rbegin(); entry!=lastEntries.rend(); entry++)
+	{
+	    XRefValue* value = entry->second;
+	    if (entry->first && !value->used() && !usedIds.count(entry->first) &&
+		value->generationNumber() < MAX_GENERATION_NUMBER)
+		freeIds.push_back(std::make_pair(entry->first, value->generationNumber()));
+	}
+    }
+
+    Object* Parser::newObject()
+    {
+	int objectId, generationNumber = 0;
+
+	if (!freeIds.empty())
+	{
+	    objectId = freeIds.back().first;
+	    generationNumber = freeIds.back().second;
+	    freeIds.pop_back();
+
+	    // Freed object is replaced by the new one
+	    std::vector<Object*>::iterator it = _objects.begin();
+	    while (it != _objects.end())
+	    {
+		if ((*it)->objectId() != objectId || (*it)->used())
+		{
+		    it++;
+		    continue;
+		}
+
+		dirtyObjects.erase(std::remove(dirtyObjects.begin(), dirtyObjects.end(), *it),
+				   dirtyObjects.end());
+		for (unsigned int i=0; i<_xrefTable.size(); i++)
+		{
+		    if (_xrefTable[i].object() == *it)
+			_xrefTable[i].setObject(0);
+		}
+		delete *it;
+		it = _objects.erase(it);
+	    }
+	}
+	else
+	    objectId = maxObjectId + 1;
+
+	Object* object = new Object(objectId, generationNumber, 0, true);
+	addObject(object);
+
+	return object;
+    }
+
+    void Parser::freeObject(Object* object)
+    {
+	if (!object->used())
+	    return;
+
+	// Free entry contains next generation number to use
+	object->setUsed(false);
+	object->setGenerationNumber(object->generationNumber() + 1);
+	object->update();
+
+	if (object->generationNumber() < MAX_GENERATION_NUMBER)
+	    freeIds.push_back(std::make_pair(object->objectId(), object->generationNumber()));
+    }
+
+    void Parser::parse(const std::string& filename)
+    {
+	openFile(filename);
+	parseObjects();
+	endParse();
 	
 	// close(fd);
     }
@@ -824,142 +1014,409 @@ namespace uPDFParser
 	}
     }
     
+    // Offsets in xref tables have 10 digits
+    static const uint64_t MAX_XREF_TABLE_OFFSET = 9999999999ULL;
+
+    /**
+     * @brief Write a 20 bytes xref entry : "oooooooooo ggggg n\r\n"
+     */
+    static inline void writeXrefEntry(Sink& sink, uint64_t offset, int generationNumber, char type)
+    {
+	char entry[20];
+	int i;
+
+	if (offset > MAX_XREF_TABLE_OFFSET)
+	    EXCEPTION(UNABLE_TO_WRITE_FILE, "Offset " << offset << " too big for a xref table, use a xref stream");
+
+	for (i=9; i>=0; i--, offset /= 10)
+	    entry[i] = '0' + (offset % 10);
+	entry[10] = ' ';
+	for (i=15; i>=11; i--, generationNumber /= 10)
+	    entry[i] = '0' + (generationNumber % 10);
+	entry[16] = ' ';
+	entry[17] = type;
+	entry[18] = '\r'; // Here \r seems important
+	entry[19] = '\n';
+
+	sink.append(entry, sizeof(entry));
+    }
+
+    void Parser::writeXref(Sink& sink, std::vector<XRefValue>& entries, bool fullTable)
+    {
+	std::vector<XRefValue>::iterator it, runEnd;
+	std::vector<XRefValue> table;
+	int nextFree = 0;
+
+	std::stable_sort(entries.begin(), entries.end(),
+			 [](const XRefValue& a, const XRefValue& b) {return a.objectId() < b.objectId();});
+
+	// Keep only last entry for each object
+	it = entries.begin();
+	while (it != entries.end())
+	{
+	    runEnd = it + 1;
+	    while (runEnd != entries.end() && runEnd->objectId() == it->objectId())
+		runEnd++;
+	    if (it->objectId() > 0)
+		table.push_back(*(runEnd-1));
+	    it = runEnd;
+	}
+
+	if (fullTable)
+	{
+	    // Complete table starting from object 0, gaps are free entries
+	    int maxId = table.size() ? table.back().objectId() : 0;
+	    std::vector<XRefValue> fullEntries;
+	    fullEntries.reserve(maxId+1);
+	    fullEntries.push_back(XRefValue(0, 0, 65535, false));
+
+	    for (it=table.begin(); it!=table.end(); it++)
+	    {
+		for (int id=fullEntries.size(); id<it->objectId(); id++)
+		    fullEntries.push_back(XRefValue(id, 0, 0, false));
+		fullEntries.push_back(*it);
+	    }
+
+	    // Link free entries
+	    std::vector<XRefValue>::reverse_iterator rit;
+	    for (rit=fullEntries.rbegin(); rit!=fullEntries.rend(); rit++)
+	    {
+		if (rit->used())
+		    continue;
+		*rit = XRefValue(rit->objectId(), nextFree, rit->generationNumber(), false);
+		nextFree = rit->objectId();
+	    }
+
+	    table.swap(fullEntries);
+	}
+
+	sink.append("xref\n");
+
+	// One subsection per contiguous range of ids
+	it = table.begin();
+	while (it != table.end())
+	{
+	    runEnd = it + 1;
+	    while (runEnd != table.end() && runEnd->objectId() == (runEnd-1)->objectId() + 1)
+		runEnd++;
+
+	    sink.appendInteger(it->objectId());
+	    sink.append(' ');
+	    sink.appendInteger(runEnd - it);
+	    sink.append('\n');
+
+	    for (; it!=runEnd; it++)
+	    {
+		if (it->used())
+		    writeXrefEntry(sink, it->offset(), it->generationNumber(), 'n');
+		else
+		    writeXrefEntry(sink, fullTable ? it->offset() : 0, it->generationNumber(), 'f');
+	    }
+	}
+    }
+
     void Parser::writeUpdate(const std::string& filename)
     {
 	struct stat _stat;
 
 	int statRet = stat(filename.c_str(), &_stat);
+	bool copyFile = (statRet == -1 && errno == ENOENT);
+	std::vector<std::pair<off_t, off_t> > savedOffsets;
+	std::vector<Object*> toWrite;
+	off_t newXrefOffset;
 
-	int newFd = open(filename.c_str(), O_WRONLY|O_APPEND|O_CREAT, S_IRUSR|S_IWUSR);
+	// O_APPEND prevents kernel side copy, only use it for existing files
+	int newFd = open(filename.c_str(), O_WRONLY|O_CREAT|(copyFile ? O_TRUNC : O_APPEND), S_IRUSR|S_IWUSR);
 
 	if (newFd <= 0)
 	    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to open " << filename << " (%m)");
 
-	// Copy file if it doesn't exists
-	if (statRet == -1 && errno == ENOENT)
+	try
 	{
-	    char buffer[4096];
-	    int ret;
-	    lseek(fd, 0, SEEK_SET);
+	    FileSink sink(newFd, (statRet == 0) ? _stat.st_size : 0);
 
-	    while (true)
+	    // Copy file if it doesn't exists
+	    if (copyFile)
 	    {
-		ret = ::read(fd, buffer, sizeof(buffer));
-		if (ret <= 0)
-		    break;
-		::write(newFd, buffer, ret);
+		if (fstat(fd, &_stat))
+		    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to stat source file (%m)");
+
+		sink.copyFile(fd, _stat.st_size);
 	    }
-	}
 	
-	::write(newFd, "\r", 1);
+	    sink.append('\r');
+
+	    std::vector<XRefValue> xref;
+	    int maxId = 0;
+
+	    // Only objects recorded as added or updated, that are still owned by
+	    // parser (they may have been removed and deleted through objects())
+	    std::set<Object*> owned(_objects.begin(), _objects.end()), recorded;
+	    std::vector<Object*>::iterator it;
+	    for(it=dirtyObjects.begin(); it!=dirtyObjects.end(); it++)
+	    {
+		if (owned.count(*it) && (*it)->isNew() && recorded.insert(*it).second)
+		    toWrite.push_back(*it);
+	    }
+
+	    for(it=toWrite.begin(); it!=toWrite.end(); it++)
+	    {
+		curOffset = sink.offset();
+		// Free objects only have an xref entry
+		if ((*it)->used())
+		    (*it)->serialize(sink);
+		savedOffsets.push_back(std::make_pair(curOffset, (off_t)sink.offset()));
+		xref.push_back(XRefValue((*it)->objectId(), (*it)->used() ? curOffset : 0,
+					 (*it)->generationNumber(), (*it)->used()));
+
+		if ((*it)->objectId() > maxId)
+		    maxId = (*it)->objectId();
+	    }
+
+	    if (toWrite.empty())
+	    {
+		sink.flush();
+		dirtyObjects.clear();
+		int ret = close(newFd);
+		newFd = -1;
+		if (ret)
+		    EXCEPTION(UNABLE_TO_WRITE_FILE, "Unable to close file (%m)");
+		return;
+	    }
+
+	    newXrefOffset = sink.offset();
+
+	    writeXref(sink, xref, false);
+
+	    trailer.deleteKey("Prev");
+	    if (xrefOffset != (off_t)-1)
+		trailer.dictionary().addData("Prev", new Integer(xrefOffset));
+
+	    // Size must cover new objects
+	    if (!trailer.hasKey("Size") ||
+		trailer["Size"]->type() != DataType::TYPE::INTEGER ||
+		((Integer*)trailer["Size"])->value() <= maxId)
+	    {
+		trailer.deleteKey("Size");
+		trailer.dictionary().addData("Size", new Integer(maxId+1));
+	    }
+
+	    sink.append("trailer\n");
+	    trailer.dictionary().serialize(sink);
 
-	std::stringstream xref;
-	int nbNewObjects = 0;
+	    sink.append("startxref\n");
+	    sink.appendInteger(newXrefOffset);
+	    sink.append("\n%%EOF");
 
-	xref << std::setfill('0');
-	xref << "xref\n";
+	    sink.flush();
+	}
+	catch (...)
+	{
+	    if (newFd != -1)
+		close(newFd);
+	    throw;
+	}
 	
-	std::vector<Object*>::iterator it;
-	for(it=_objects.begin(); it!=_objects.end(); it++)
+	if (close(newFd))
+	    EXCEPTION(UNABLE_TO_WRITE_FILE, "Unable to close file (%m)");
+
+	// Now, file is the original one + our update : continue to work on it
+	// Keep the same fd number as it's shared with streams
+	int readFd = open(filename.c_str(), O_RDONLY);
+	if (readFd <= 0)
+	    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to open " << filename << " (%m)");
+
+	if (fd)
 	{
-	    if (!(*it)->isNew())
-		continue;
-	    nbNewObjects ++;
-	    std::string objStr = (*it)->str();
-	    curOffset = lseek(newFd, 0, SEEK_CUR);
-	    ::write(newFd, objStr.c_str(), objStr.size());
-	    xref << std::setw(0) << (*it)->objectId() << " 1\n";
-	    xref << std::setw(10) << curOffset << " " << std::setw(5) << (*it)->generationNumber() << " n\r\n"; // Here \r seems important 
+	    dup2(readFd, fd);
+	    close(readFd);
 	}
+	else
+	    fd = readFd;
+
+	// Next update will be linked to this one
+	xrefOffset = newXrefOffset;
 
-	if (!nbNewObjects)
+	for(unsigned int i=0; i<toWrite.size(); i++)
 	{
-	    close(newFd);
+	    toWrite[i]->setOffset(savedOffsets[i].first);
+	    toWrite[i]->setEndOffset(savedOffsets[i].second);
+	    toWrite[i]->setNew(false);
+	}
+	dirtyObjects.clear();
+    }
+    
+    void Parser::writeHeader(Sink& sink, int version_major, int version_minor)
+    {
+	char header[18];
+	int ret = snprintf(header, sizeof(header), "%%PDF-%d.%d\r%%%c%c%c%c\r\n",
+			   version_major, version_minor, 0xe2, 0xe3, 0xcf, 0xd3);
+	
+	sink.append(header, ret);
+    }
+
+    void Parser::writeHeader(Sink& sink, int minor)
+    {
+	writeHeader(sink, version_major,
+		    (version_major == 1 && version_minor < minor) ? minor : version_minor);
+    }
+
+    /**
+     * @brief Call fn(thread, begin, end) with nbThreads threads,
+     * each one working on a contiguous part of [0, count[
+     */
+    static void parallelFor(unsigned int count, unsigned int nbThreads,
+			    const std::function<void(unsigned int, unsigned int, unsigned int)>& fn)
+    {
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> errors(nbThreads);
+
+	if (nbThreads > count)
+	    nbThreads = count;
+
+	if (nbThreads <= 1)
+	{
+	    if (count) fn(0, 0, count);
 	    return;
 	}
 
-	off_t newXrefOffset = lseek(newFd, 0, SEEK_CUR);
+	for (unsigned int i=0; i<nbThreads; i++)
+	{
+	    threads.push_back(std::thread([&, i]() {
+		try
+		{
+		    fn(i, (count*i)/nbThreads, (count*(i+1))/nbThreads);
+		}
+		catch (...)
+		{
+		    errors[i] = std::current_exception();
+		}
+	    }));
+	}
 
-	std::string xrefStr = xref.str();
-	::write(newFd, xrefStr.c_str(), xrefStr.size());
+	for (unsigned int i=0; i<nbThreads; i++)
+	    threads[i].join();
 
-	trailer.deleteKey("Prev");
-	if (xrefOffset != (off_t)-1)
-	    trailer.dictionary().addData("Prev", new Integer((int)xrefOffset));
+	for (unsigned int i=0; i<nbThreads; i++)
+	{
+	    if (errors[i])
+		std::rethrow_exception(errors[i]);
+	}
+    }
 
-	std::string trailerStr = trailer.dictionary().str();
-	::write(newFd, "trailer\n", 8);
-	::write(newFd, trailerStr.c_str(), trailerStr.size());
+    bool Parser::canCopy(Object* object)
+    {
+	return fd && !object->isNew() && object->endOffset() > object->offset();
+    }
 
-	std::stringstream startxref;
-	startxref << "startxref\n" << newXrefOffset << "\n%%EOF";
-	
-	std::string startxrefStr = startxref.str();
-	::write(newFd, startxrefStr.c_str(), startxrefStr.size());
-	
-	close(newFd);
+    void Parser::serializeObjects(std::vector<Object*>& objects, unsigned int nbThreads,
+				  std::vector<SegmentSink>& buffers, std::vector<SerializedRange>& ranges)
+    {
+	std::vector<unsigned int> toSerialize;
+
+	for (unsigned int i=0; i<objects.size(); i++)
+	{
+	    if (objects[i]->used() && !canCopy(objects[i]))
+		toSerialize.push_back(i);
+	}
+
+	buffers.resize(nbThreads);
+	ranges.resize(objects.size());
+
+	parallelFor(toSerialize.size(), nbThreads,
+		    [&](unsigned int thread, unsigned int begin, unsigned int end) {
+			SegmentSink& buffer = buffers[thread];
+			for (unsigned int i=begin; i<end; i++)
+			{
+			    SerializedRange& range = ranges[toSerialize[i]];
+			    range.buffer = &buffer;
+			    range.start = buffer.offset();
+			    objects[toSerialize[i]]->serialize(buffer);
+			    range.end = buffer.offset();
+			}
+		    });
     }
-    
-    void Parser::write(const std::string& filename, bool update)
+
+    off_t Parser::writeObject(Sink& sink, Object* object, ObjectRun& run, SerializedRange* serialized)
     {
-	if (update)
-	    return writeUpdate(filename);
+	// Unmodified objects are copied verbatim from source file
+	// Contiguous ones are copied in a single operation
+	if (canCopy(object))
+	{
+	    if (run.end != object->offset())
+	    {
+		copyRun(sink, run);
+		run.start = object->offset();
+		run.sinkOffset = sink.offset();
+	    }
+	    run.end = object->endOffset();
+	    return run.sinkOffset + (object->offset() - run.start);
+	}
 
-	int newFd = open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	copyRun(sink, run);
 
-	if (newFd <= 0)
-	    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to open " << filename << " (%m)");
+	off_t offset = sink.offset();
+	if (serialized && serialized->buffer)
+	    serialized->buffer->replay(sink, serialized->start, serialized->end);
+	else
+	    object->serialize(sink);
 
-	char header[18];
-	int ret = snprintf(header, sizeof(header), "%%PDF-%d.%d\r%%%c%c%c%c\r\n",
-			   version_major, version_minor,
-			   0xe2, 0xe3, 0xcf, 0xd3);
-	
-	::write(newFd, header, ret);
+	return offset;
+    }
+
+    void Parser::copyRun(Sink& sink, ObjectRun& run)
+    {
+	if (run.start == run.end)
+	    return;
+
+	sink.copyFrom(fd, run.start, run.end - run.start);
+
+	if (sink.last() != '\n' && sink.last() != '\r')
+	    sink.append('\n');
+
+	run.start = run.end = 0;
+    }
+
+    void Parser::writeTable(Sink& sink, std::vector<Object*>& objects, unsigned int nbThreads)
+    {
+	writeHeader(sink);
 
 	int maxId = 0;
-	std::stringstream xref;
+	std::vector<XRefValue> xref;
 	off_t xrefStmOffset = 0;
+	ObjectRun run;
+	std::vector<SegmentSink> buffers;
+	std::vector<SerializedRange> serialized;
 	
-	xref << std::setfill('0');
-	xref << "xref\n";
-	xref << "0 1\n";
-	xref << "0000000000 65535 f\r\n";
-	
-	std::vector<Object*>::iterator it;
-	for(it=_objects.begin(); it!=_objects.end(); it++)
+	xref.reserve(objects.size());
+
+	// Serialize modified objects concurrently, then write them in order
+	if (nbThreads > 1)
+	    serializeObjects(objects, nbThreads, buffers, serialized);
+
+	for(unsigned int i=0; i<objects.size(); i++)
 	{
-	    Object* object = *it;
-	    std::string objStr = object->str();
-	    curOffset = lseek(newFd, 0, SEEK_CUR);
-	    ::write(newFd, objStr.c_str(), objStr.size());
-	    xref << std::setw(0) << object->objectId() << " 1\n";
-	    xref << std::setw(10) << curOffset << " " << std::setw(5) << object->generationNumber();
+	    Object* object = objects[i];
+
+	    // Free objects only have an xref entry
+	    curOffset = 0;
 	    if (object->used())
-		xref << " n";
-	    else
-		xref << " f" ; 
-	    xref << "\r\n" ; // Here \r seems important
+		curOffset = writeObject(sink, object, run, serialized.empty() ? 0 : &serialized[i]);
+
+	    xref.push_back(XRefValue(object->objectId(), curOffset, object->generationNumber(), object->used()));
 
 	    if (object->objectId() > maxId)
 		maxId = object->objectId();
 
 	    if (object->hasKey("Type") && (*object)["Type"]->str() == "/XRef")
-	    {
-		// Try to keep Prev link valid
-		if (object->hasKey("Prev") && xrefStmOffset != 0)
-		{
-		    object->deleteKey("Prev");
-		    object->dictionary().addData("Prev", new Integer(xrefStmOffset));
-		}
 		xrefStmOffset = curOffset;
-	    }
 	}
 
-	off_t newXrefOffset = lseek(newFd, 0, SEEK_CUR);
+	copyRun(sink, run);
 
-	std::string xrefStr = xref.str();
-	::write(newFd, xrefStr.c_str(), xrefStr.size());
+	off_t newXrefOffset = sink.offset();
+
+	writeXref(sink, xref, true);
 
 	trailer.deleteKey("Prev");
 	trailer.deleteKey("Size");
@@ -969,16 +1426,1736 @@ namespace uPDFParser
 	if (xrefStmOffset != 0)
 	    trailer.dictionary().addData("XRefStm", new Integer(xrefStmOffset));
 
-	std::string trailerStr = trailer.dictionary().str();
-	::write(newFd, "trailer\n", 8);
-	::write(newFd, trailerStr.c_str(), trailerStr.size());
+	sink.append("trailer\n");
+	trailer.dictionary().serialize(sink);
 
-	std::stringstream startxref;
-	startxref << "startxref\n" << newXrefOffset << "\n%%EOF";
-	
-	std::string startxrefStr = startxref.str();
-	::write(newFd, startxrefStr.c_str(), startxrefStr.size());
+	sink.append("startxref\n");
+	sink.appendInteger(newXrefOffset);
+	sink.append("\n%%EOF");
+    }
+
+    static bool isXrefStream(Object* object)
+    {
+	return object->hasKey("Type") && (*object)["Type"]->str() == "/XRef";
+    }
+
+    static Stream* getStream(Object* object)
+    {
+	std::vector<DataType*>::iterator it;
+	for(it=object->data().begin(); it!=object->data().end(); it++)
+	{
+	    if ((*it)->type() == DataType::TYPE::STREAM)
+		return (Stream*)*it;
+	}
+
+	return 0;
+    }
+
+    /**
+     * @brief Revert PNG predictors (1 byte per pixel)
+     */
+    static void unpredictPNG(std::string& data, int columns)
+    {
+	std::string res;
+	std::string prevRow(columns, '\0');
+	int rowSize = columns + 1;
+
+	res.reserve(data.size());
+
+	for (size_t pos=0; pos + rowSize <= data.size(); pos += rowSize)
+	{
+	    unsigned char filter = data[pos];
+	    unsigned char* row = (unsigned char*)&data[pos+1];
+	    unsigned char* prev = (unsigned char*)&prevRow[0];
+
+	    for (int i=0; i<columns; i++)
+	    {
+		int left = i ? row[i-1] : 0;
+		int up = prev[i];
+		int upLeft = i ? prev[i-1] : 0;
+
+		switch (filter)
+		{
+		case 0: break;
+		case 1: row[i] += left; break;
+		case 2: row[i] += up; break;
+		case 3: row[i] += (left + up) / 2; break;
+		case 4:
+		{
+		    int p = left + up - upLeft;
+		    int pa = abs(p - left), pb = abs(p - up), pc = abs(p - upLeft);
+		    if (pa <= pb && pa <= pc) row[i] += left;
+		    else if (pb <= pc) row[i] += up;
+		    else row[i] += upLeft;
+		    break;
+		}
+		default:
+		    EXCEPTION(INVALID_STREAM, "Invalid PNG predictor " << (int)filter);
+		}
+	    }
+
+	    prevRow.assign((const char*)row, columns);
+	    res += prevRow;
+	}
+
+	data.swap(res);
+    }
+
+    /**
+     * @brief Decode stream data (no filter or FlateDecode only)
+     */
+    static void decodeStream(Object* object, Stream* stream, std::string& data)
+    {
+	Dictionary& dict = object->dictionary();
+
+	// Stream data is not kept in memory
+	if (dict.hasKey("Filter"))
+	{
+	    DataType* filter = dict.value()["Filter"];
+	    if (filter->type() == DataType::TYPE::ARRAY && ((Array*)filter)->value().size() == 1)
+		filter = ((Array*)filter)->value()[0];
+	    if (filter->str() != "/FlateDecode")
+		EXCEPTION(NOT_IMPLEMENTED, "Unsupported stream filter " << filter->str() << " in object " << object->objectId());
+
+	    std::string rawData;
+	    stream->readData(rawData);
+	    Flate::decompress((const unsigned char*)rawData.c_str(), rawData.size(), data);
+	}
+	else
+	    stream->readData(data);
+    }
+
+    void Parser::readXrefStreams(std::map<int, std::pair<int, int> >& compressed)
+    {
+	std::vector<Object*>::iterator it;
+	for(it=_objects.begin(); it!=_objects.end(); it++)
+	{
+	    Object* object = *it;
+
+	    if (!isXrefStream(object))
+		continue;
+
+	    Stream* stream = getStream(object);
+	    if (!stream)
+		EXCEPTION(INVALID_STREAM, "XRef object " << object->objectId() << " without stream");
+
+	    Dictionary& dict = object->dictionary();
+	    std::string data;
+
+	    decodeStream(object, stream, data);
+
+	    if (dict.hasKey("DecodeParms") && dict.value()["DecodeParms"]->type() == DataType::TYPE::DICTIONARY)
+	    {
+		Dictionary* params = (Dictionary*)dict.value()["DecodeParms"];
+		int predictor = getInteger(*params, "Predictor", 1);
+		if (predictor >= 10)
+		    unpredictPNG(data, getInteger(*params, "Columns", 1));
+		else if (predictor != 1)
+		    EXCEPTION(NOT_IMPLEMENTED, "Unsupported XRef stream predictor " << predictor);
+	    }
+
+	    if (!dict.hasKey("W") || dict.value()["W"]->type() != DataType::TYPE::ARRAY ||
+		((Array*)dict.value()["W"])->value().size() != 3)
+		EXCEPTION(INVALID_STREAM, "Invalid W in XRef object " << object->objectId());
+
+	    int widths[3], entrySize = 0;
+	    for (int i=0; i<3; i++)
+	    {
+		DataType* width = ((Array*)dict.value()["W"])->value()[i];
+		widths[i] = (width->type() == DataType::TYPE::INTEGER) ? ((Integer*)width)->value() : 0;
+		entrySize += widths[i];
+	    }
+
+	    std::vector<int> index;
+	    if (dict.hasKey("Index") && dict.value()["Index"]->type() == DataType::TYPE::ARRAY)
+	    {
+		std::vector<DataType*>& values = ((Array*)dict.value()["Index"])->value();
+		for (unsigned int i=0; i<values.size(); i++)
+		    index.push_back((values[i]->type() == DataType::TYPE::INTEGER) ? ((Integer*)values[i])->value() : 0);
+	    }
+	    else
+	    {
+		index.push_back(0);
+		index.push_back(getInteger(dict, "Size", 0));
+	    }
+
+	    const unsigned char* entry = (const unsigned char*)data.c_str();
+	    const unsigned char* end = entry + data.size();
+
+	    for (unsigned int i=0; i+1<index.size(); i+=2)
+	    {
+		for (int id=index[i]; id<index[i]+index[i+1] && entry + entrySize <= end; id++)
+		{
+		    uint64_t fields[3];
+		    for (int f=0; f<3; f++)
+		    {
+			fields[f] = 0;
+			for (int b=0; b<widths[f]; b++)
+			    fields[f] = (fields[f] << 8) | *entry++;
+		    }
+		    // Type defaults to 1 if field is absent
+		    if (!widths[0])
+			fields[0] = 1;
+
+		    if (fields[0] == 2)
+			compressed[id] = std::make_pair((int)fields[1], (int)fields[2]);
+		    else
+			compressed.erase(id);
+		}
+	    }
+	}
+    }
+
+    /**
+     * @brief Bits reader for hint tables (most significant bit first)
+     */
+    class BitReader
+    {
+    public:
+	BitReader(const std::string& data):
+	    data(data), position(0)
+	{}
+
+	uint64_t read(int bits)
+	{
+	    uint64_t res = 0;
+
+	    if (position + bits > data.size()*8)
+		EXCEPTION(INVALID_STREAM, "Hint table is truncated");
+
+	    for (int i=0; i<bits; i++, position++)
+		res = (res << 1) | ((data[position/8] >> (7 - position%8)) & 1);
+
+	    return res;
+	}
+
+	void skip(int bits) { position += bits; }
+
+	/**
+	 * @brief Go to next byte
+	 */
+	void align() { position = (position + 7) & ~7ULL; }
+
+    private:
+	const std::string& data;
+	uint64_t position;
+    };
+
+    void Parser::readPageHints(Object* linearization)
+    {
+	Dictionary& dict = linearization->dictionary();
+	int nbPages = getInteger(dict, "N", 0);
+
+	if (!nbPages || !dict.hasKey("H") || dict.value()["H"]->type() != DataType::TYPE::ARRAY)
+	    return;
+
+	std::vector<DataType*>& hintRange = ((Array*)dict.value()["H"])->value();
+	if (hintRange.size() < 2 ||
+	    hintRange[0]->type() != DataType::TYPE::INTEGER ||
+	    hintRange[1]->type() != DataType::TYPE::INTEGER)
+	    return;
+
+	off_t hintOffset = ((Integer*)hintRange[0])->value();
+	off_t hintLength = ((Integer*)hintRange[1])->value();
+
+	Object* hints = 0;
+	std::vector<Object*>::iterator it;
+	for(it=_objects.begin(); it!=_objects.end(); it++)
+	{
+	    if ((*it)->offset() == hintOffset)
+	    {
+		hints = *it;
+		break;
+	    }
+	}
+
+	Stream* stream = hints ? getStream(hints) : 0;
+	if (!stream || (hints->hasKey("Filter") && !Flate::available()))
+	    return;
+
+	std::string data;
+	decodeStream(hints, stream, data);
+
+	// Page offset hint table header
+	BitReader reader(data);
+	reader.read(32);                            // Least number of objects in a page
+	uint64_t offset = reader.read(32);          // First page object location
+	int objectsBits = reader.read(16);
+	uint64_t minLength = reader.read(32);
+	int lengthBits = reader.read(16);
+	reader.skip(32+16+32+16+16+16+16+16);       // Content streams and shared objects
+
+	for (int page=0; page<nbPages; page++)
+	    reader.read(objectsBits);
+	reader.align();
+
+	// Offsets in hint tables don't include hint stream
+	std::vector<off_t> offsets;
+	for (int page=0; page<nbPages; page++)
+	{
+	    offsets.push_back((offset >= (uint64_t)hintOffset) ? offset + hintLength : offset);
+	    offset += minLength + reader.read(lengthBits);
+	}
+	offsets.push_back((offset >= (uint64_t)hintOffset) ? offset + hintLength : offset);
+
+	pageOffsets.swap(offsets);
+    }
+
+    bool Parser::parseFirstPage(const std::string& filename)
+    {
+	std::string token;
+
+	openFile(filename);
+
+	// Linearization dictionary must be the first object
+	token = nextToken(false);
+	if (!token.size() || token[0] < '1' || token[0] > '9')
+	{
+	    curOffset = bodyOffset;
+	    lseek(fd, curOffset, SEEK_SET);
+	    return false;
+	}
+
+	parseObject(token);
+	Object* linearization = _objects.back();
+
+	if (!linearization->hasKey("Linearized"))
+	    return false;
+
+	off_t firstPageEnd = getInteger(linearization->dictionary(), "E", 0);
+	if (!firstPageEnd)
+	    return false;
+
+	parseObjects(firstPageEnd);
+	endParse();
+
+	readPageHints(linearization);
+
+	return true;
+    }
+
+    void Parser::parseRemaining()
+    {
+	if (!fd)
+	    EXCEPTION(UNABLE_TO_OPEN_FILE, "No file opened");
+
+	parseObjects();
+	endParse();
+    }
+
+    /**
+     * @brief Minimal number of bytes needed to store value
+     */
+    static int bytesNeeded(uint64_t value)
+    {
+	int res = 1;
+	while (value >>= 8)
+	    res++;
+	return res;
+    }
+
+    static Object* newStreamObject(int objectId, const char* type, std::string& data, std::string& compressed)
+    {
+	Object* object = new Object(objectId, 0, 0, true);
+	Dictionary& dict = object->dictionary();
+	std::string* payload = &data;
+
+	if (type)
+	    dict.addData("Type", new Name(type));
+	if (Flate::compress((const unsigned char*)data.c_str(), data.size(), compressed))
+	{
+	    dict.addData("Filter", new Name("/FlateDecode"));
+	    payload = &compressed;
+	}
+	dict.addData("Length", new Integer(payload->size()));
+
+	object->data().push_back(new Stream(dict, 0, 0, (unsigned char*)payload->c_str(), payload->size()));
+
+	return object;
+    }
+
+    void Parser::writeCompressed(Sink& sink, std::vector<Object*>& objects, unsigned int nbThreads)
+    {
+	std::map<int, std::pair<int, int> > compressed;
+	std::map<int, Object*> latest;
+	std::vector<Object*> toPack, topLevel;
+	std::vector<Object*>::iterator it;
+	ObjectRun run;
+	std::vector<SegmentSink> buffers;
+	std::vector<SerializedRange> serialized;
+	int maxId = 0;
+	// Encryption dictionary can't be in an object stream, neither strings
+	// of encrypted documents (they're encrypted using object number)
+	bool encrypted = trailer.hasKey("Encrypt");
+
+	readXrefStreams(compressed);
+
+	// Only write last version of each object
+	for(it=objects.begin(); it!=objects.end(); it++)
+	{
+	    if (!isXrefStream(*it))
+		latest[(*it)->objectId()] = *it;
+	}
+
+	// Keep compressed objects only if their object stream is written
+	std::map<int, std::pair<int, int> >::iterator cit = compressed.begin();
+	while (cit != compressed.end())
+	{
+	    if (latest.count(cit->second.first))
+		cit++;
+	    else
+		cit = compressed.erase(cit);
+	}
+
+	if (!latest.empty())
+	    maxId = latest.rbegin()->first;
+	if (!compressed.empty() && compressed.rbegin()->first > maxId)
+	    maxId = compressed.rbegin()->first;
+
+	// type, field2, field3 for each object
+	std::vector<uint64_t> entries((maxId+1)*3, 0);
+
+	for(cit=compressed.begin(); cit!=compressed.end(); cit++)
+	{
+	    entries[cit->first*3]   = 2;
+	    entries[cit->first*3+1] = cit->second.first;
+	    entries[cit->first*3+2] = cit->second.second;
+	}
+
+	writeHeader(sink, 5);
+
+	// Objects that can't be packed are written first
+	for(it=objects.begin(); it!=objects.end(); it++)
+	{
+	    Object* object = *it;
+
+	    if (latest[object->objectId()] != object)
+		continue;
+
+	    int id = object->objectId();
+
+	    if (!encrypted && object->used() && object->generationNumber() == 0 &&
+		!getStream(object))
+		toPack.push_back(object);
+	    else if (object->used())
+		topLevel.push_back(object);
+	    else
+	    {
+		entries[id*3]   = 0;
+		entries[id*3+2] = object->generationNumber();
+	    }
+	}
+
+	if (nbThreads > 1)
+	    serializeObjects(topLevel, nbThreads, buffers, serialized);
+
+	for(unsigned int i=0; i<topLevel.size(); i++)
+	{
+	    int id = topLevel[i]->objectId();
+	    entries[id*3]   = 1;
+	    entries[id*3+1] = writeObject(sink, topLevel[i], run, serialized.empty() ? 0 : &serialized[i]);
+	    entries[id*3+2] = topLevel[i]->generationNumber();
+	}
+
+	copyRun(sink, run);
+
+	// Pack other objects into object streams (built concurrently)
+	unsigned int nbStreams = (toPack.size() + OBJECTS_PER_STREAM - 1) / OBJECTS_PER_STREAM;
+	std::vector<Object*> objStms(nbStreams, 0);
+	std::vector<std::string> payloads(nbStreams*2);
+
+	entries.resize((maxId+nbStreams+1)*3, 0);
+
+	parallelFor(nbStreams, nbThreads,
+		    [&](unsigned int, unsigned int begin, unsigned int end) {
+			for (unsigned int stream=begin; stream<end; stream++)
+			{
+			    std::string& offsets = payloads[stream*2];
+			    std::string content;
+			    StringSink offsetsSink(offsets), contentSink(content);
+			    unsigned int first = stream * OBJECTS_PER_STREAM;
+			    unsigned int last = std::min(first + OBJECTS_PER_STREAM, (unsigned int)toPack.size());
+			    int objStmId = maxId + 1 + stream;
+
+			    for (unsigned int i=first; i<last; i++)
+			    {
+				int id = toPack[i]->objectId();
+				entries[id*3]   = 2;
+				entries[id*3+1] = objStmId;
+				entries[id*3+2] = i - first;
+
+				offsetsSink.appendInteger(id);
+				offsetsSink.append(' ');
+				offsetsSink.appendInteger(content.size());
+				offsetsSink.append(' ');
+				toPack[i]->serializeContent(contentSink);
+			    }
+
+			    int firstOffset = offsets.size();
+			    offsets += content;
+
+			    Object* objStm = newStreamObject(objStmId, "/ObjStm", offsets, payloads[stream*2+1]);
+			    objStm->dictionary().addData("N", new Integer(last - first));
+			    objStm->dictionary().addData("First", new Integer(firstOffset));
+			    objStms[stream] = objStm;
+			}
+		    });
+
+	for (unsigned int stream=0; stream<nbStreams; stream++)
+	{
+	    int objStmId = objStms[stream]->objectId();
+	    entries[objStmId*3]   = 1;
+	    entries[objStmId*3+1] = sink.offset();
+	    objStms[stream]->serialize(sink);
+	    delete objStms[stream];
+	}
+
+	// Finally, XRef stream (with its own entry)
+	int xrefId = maxId + nbStreams + 1;
+	off_t newXrefOffset = sink.offset();
+
+	entries.resize((xrefId+1)*3, 0);
+	entries[xrefId*3]   = 1;
+	entries[xrefId*3+1] = newXrefOffset;
+
+	// Link free entries
+	int nextFree = 0;
+	for (int id=xrefId; id>=0; id--)
+	{
+	    if (entries[id*3] != 0)
+		continue;
+	    entries[id*3+1] = nextFree;
+	    nextFree = id;
+	}
+	entries[2] = 65535;
+
+	uint64_t maxField2 = 0, maxField3 = 0;
+	for (int id=0; id<=xrefId; id++)
+	{
+	    if (entries[id*3+1] > maxField2) maxField2 = entries[id*3+1];
+	    if (entries[id*3+2] > maxField3) maxField3 = entries[id*3+2];
+	}
+
+	int widths[3] = {1, bytesNeeded(maxField2), bytesNeeded(maxField3)};
+	std::string data, compressedData;
+
+	data.reserve((xrefId+1) * (widths[0] + widths[1] + widths[2]));
+	for (int id=0; id<=xrefId; id++)
+	{
+	    for (int f=0; f<3; f++)
+	    {
+		for (int b=widths[f]-1; b>=0; b--)
+		    data += (char)((entries[id*3+f] >> (b*8)) & 0xFF);
+	    }
+	}
+
+	Object* xrefStm = newStreamObject(xrefId, "/XRef", data, compressedData);
+	Dictionary& dict = xrefStm->dictionary();
+
+	Array* W = new Array();
+	for (int f=0; f<3; f++)
+	    W->addData(new Integer(widths[f]));
+	dict.addData("W", W);
+	dict.addData("Size", new Integer(xrefId+1));
+
+	static const char* keys[] = {"Root", "Info", "Encrypt", "ID"};
+	for (int i=0; i<(int)(sizeof(keys)/sizeof(keys[0])); i++)
+	{
+	    if (trailer.hasKey(keys[i]))
+		dict.addData(keys[i], trailer[keys[i]]->clone());
+	}
+
+	xrefStm->serialize(sink);
+	delete xrefStm;
+
+	sink.append("startxref\n");
+	sink.appendInteger(newXrefOffset);
+	sink.append("\n%%EOF");
+    }
+
+    /**
+     * @brief Add objects referenced by data into refs
+     */
+    static void collectReferences(DataType* data, std::vector<int>& refs)
+    {
+	if (!data)
+	    return;
+
+	switch (data->type())
+	{
+	case DataType::TYPE::REFERENCE:
+	    refs.push_back(((Reference*)data)->value());
+	    break;
+	case DataType::TYPE::ARRAY:
+	{
+	    std::vector<DataType*>& values = ((Array*)data)->value();
+	    for (unsigned int i=0; i<values.size(); i++)
+		collectReferences(values[i], refs);
+	    break;
+	}
+	case DataType::TYPE::DICTIONARY:
+	{
+	    std::map<std::string, DataType*>& values = ((Dictionary*)data)->value();
+	    std::map<std::string, DataType*>::iterator it;
+	    for (it=values.begin(); it!=values.end(); it++)
+		collectReferences(it->second, refs);
+	    break;
+	}
+	default:
+	    break;
+	}
+    }
+
+    static void collectReferences(Object* object, std::vector<int>& refs)
+    {
+	collectReferences(&object->dictionary(), refs);
+
+	std::vector<DataType*>::iterator it;
+	for (it=object->data().begin(); it!=object->data().end(); it++)
+	    collectReferences(*it, refs);
+    }
+
+    bool Parser::reachableObjects(std::vector<Object*>& objects)
+    {
+	std::map<int, Object*> latest;
+	std::map<int, std::pair<int, int> > compressed;
+	std::set<int> reached;
+	std::vector<int> toVisit;
+	std::vector<Object*>::iterator it;
+
+	for(it=_objects.begin(); it!=_objects.end(); it++)
+	    latest[(*it)->objectId()] = *it;
+
+	// Content of object streams is not parsed
+	if (xrefObject)
+	    readXrefStreams(compressed);
+
+	static const char* roots[] = {"Root", "Info", "Encrypt"};
+	for (int i=0; i<(int)(sizeof(roots)/sizeof(roots[0])); i++)
+	{
+	    if (trailer.hasKey(roots[i]))
+		collectReferences(trailer[roots[i]], toVisit);
+	}
+
+	while (!toVisit.empty())
+	{
+	    int id = toVisit.back();
+	    toVisit.pop_back();
+
+	    if (!reached.insert(id).second)
+		continue;
+
+	    std::map<int, Object*>::iterator object = latest.find(id);
+	    if (object == latest.end())
+	    {
+		// Can't follow references of an object stored in an object stream
+		if (compressed.count(id))
+		    return false;
+		continue;
+	    }
+
+	    collectReferences(object->second, toVisit);
+	}
+
+	for(it=_objects.begin(); it!=_objects.end(); it++)
+	{
+	    if (latest[(*it)->objectId()] == *it && reached.count((*it)->objectId()))
+		objects.push_back(*it);
+	}
+
+	return true;
+    }
+
+    /**
+     * @brief Is data a reference to an object without replacement
+     * that has to be dropped ?
+     */
+    static bool droppedReference(DataType* data, std::map<int, Object*>& replacements, bool dropUnknown)
+    {
+	return dropUnknown && data && data->type() == DataType::TYPE::REFERENCE &&
+	    !replacements.count(((Reference*)data)->value());
+    }
+
+    /**
+     * @brief Make references to replaced objects point to their replacement.
+     * If dropUnknown, references to other objects become null (removed
+     * from dictionaries).
+     *
+     * @return true if data has been modified
+     */
+    static bool replaceReferences(DataType* data, std::map<int, Object*>& replacements, bool dropUnknown=false)
+    {
+	bool modified = false;
+
+	if (!data)
+	    return false;
+
+	switch (data->type())
+	{
+	case DataType::TYPE::REFERENCE:
+	{
+	    Reference* reference = (Reference*)data;
+	    std::map<int, Object*>::iterator it = replacements.find(reference->value());
+	    if (it != replacements.end())
+	    {
+		reference->setValue(it->second->objectId(), it->second->generationNumber());
+		modified = true;
+	    }
+	    break;
+	}
+	case DataType::TYPE::ARRAY:
+	{
+	    std::vector<DataType*>& values = ((Array*)data)->value();
+	    for (unsigned int i=0; i<values.size(); i++)
+	    {
+		if (droppedReference(values[i], replacements, dropUnknown))
+		{
+		    delete values[i];
+		    values[i] = new Null();
+		    modified = true;
+		}
+		else
+		    modified |= replaceReferences(values[i], replacements, dropUnknown);
+	    }
+	    break;
+	}
+	case DataType::TYPE::DICTIONARY:
+	{
+	    std::map<std::string, DataType*>& values = ((Dictionary*)data)->value();
+	    std::map<std::string, DataType*>::iterator it = values.begin();
+	    while (it != values.end())
+	    {
+		// A null value is equivalent to an absent key
+		if (droppedReference(it->second, replacements, dropUnknown))
+		{
+		    delete it->second;
+		    it = values.erase(it);
+		    modified = true;
+		}
+		else
+		    modified |= replaceReferences((it++)->second, replacements, dropUnknown);
+	    }
+	    break;
+	}
+	default:
+	    break;
+	}
+
+	return modified;
+    }
+
+    static bool replaceReferences(Object* object, std::map<int, Object*>& replacements, bool dropUnknown=false)
+    {
+	bool modified = replaceReferences(&object->dictionary(), replacements, dropUnknown);
+
+	std::vector<DataType*>::iterator it;
+	for (it=object->data().begin(); it!=object->data().end(); it++)
+	{
+	    if (droppedReference(*it, replacements, dropUnknown))
+	    {
+		delete *it;
+		*it = new Null();
+		modified = true;
+	    }
+	    else
+		modified |= replaceReferences(*it, replacements, dropUnknown);
+	}
+
+	return modified;
+    }
+
+    /**
+     * @brief Can object be replaced by an identical one ? Only objects meant
+     * to be shared are: resources (fonts, graphic states, patterns...),
+     * resource dictionaries, untyped streams (images, font files, contents...)
+     * and objects without dictionary (arrays, numbers...). Objects that have
+     * their own identity (pages, annotations, form fields, structure
+     * elements...) are kept.
+     */
+    static bool canDeduplicate(Object* object)
+    {
+	static const char* sharedTypes[] = {"/Font", "/FontDescriptor", "/Encoding", "/CMap",
+					    "/ExtGState", "/Pattern", "/Shading", "/XObject",
+					    "/Halftone", "/EmbeddedFile"};
+	static const char* sharedKeys[] = {"FunctionType", "ShadingType", "PatternType"};
+	static const std::set<std::string> resourceKeys = {"Font", "XObject", "ExtGState", "ColorSpace",
+							   "Pattern", "Shading", "ProcSet", "Properties"};
+
+	if (object->isIndirect() || !object->used())
+	    return false;
+
+	if (object->hasKey("Type"))
+	{
+	    std::string type = (*object)["Type"]->str();
+	    for (int i=0; i<(int)(sizeof(sharedTypes)/sizeof(sharedTypes[0])); i++)
+	    {
+		if (type == sharedTypes[i])
+		    return true;
+	    }
+	    return false;
+	}
+
+	if (getStream(object) || object->dictionary().empty())
+	    return true;
+
+	// Untyped functions, shadings and patterns
+	for (int i=0; i<(int)(sizeof(sharedKeys)/sizeof(sharedKeys[0])); i++)
+	{
+	    if (object->hasKey(sharedKeys[i]))
+		return true;
+	}
+
+	// Resource dictionary
+	std::map<std::string, DataType*>::iterator it;
+	for (it=object->dictionary().value().begin(); it!=object->dictionary().value().end(); it++)
+	{
+	    if (!resourceKeys.count(it->first))
+		return false;
+	}
+
+	return true;
+    }
+
+    /**
+     * @brief Deduplication candidate. Streams payloads are hashed once, the
+     * rest of object (which contains references) each time it's modified.
+     */
+    struct DedupCandidate
+    {
+	DedupCandidate(Object* object):
+	    object(object), headerHash(0), headerLength(0)
+	{
+	    HashSink sink;
+	    std::vector<DataType*>::iterator it;
+	    for (it=object->data().begin(); it!=object->data().end(); it++)
+	    {
+		if ((*it)->type() == DataType::TYPE::STREAM)
+		    (*it)->serialize(sink);
+	    }
+	    payloadHash = sink.hash();
+	    payloadLength = sink.offset();
+
+	    hashHeader();
+	}
+
+	void hashHeader()
+	{
+	    HashSink sink;
+	    object->dictionary().serialize(sink);
+	    std::vector<DataType*>::iterator it;
+	    for (it=object->data().begin(); it!=object->data().end(); it++)
+	    {
+		if ((*it)->type() != DataType::TYPE::STREAM)
+		    (*it)->serialize(sink);
+	    }
+	    headerHash = sink.hash();
+	    headerLength = sink.offset();
+	}
+
+	std::tuple<uint64_t, uint64_t, uint64_t, uint64_t> key()
+	{
+	    return std::make_tuple(headerHash, headerLength, payloadHash, payloadLength);
+	}
+
+	Object* object;
+	uint64_t headerHash, headerLength, payloadHash, payloadLength;
+    };
+
+    static bool sameContent(Object* a, Object* b)
+    {
+	// Stream data read from file is only recorded, then compared by blocks
+	SegmentSink reference;
+	a->serializeContent(reference);
+
+	CompareSink sink(reference);
+	b->serializeContent(sink);
+
+	return sink.equal();
+    }
+
+    bool Parser::canRewriteReferences(std::map<int, Object*>& latest)
+    {
+	std::map<int, std::pair<int, int> > compressed;
+
+	// Object keys depend on object id
+	if (trailer.hasKey("Encrypt"))
+	    return false;
+
+	// Content of object streams is not parsed
+	if (xrefObject)
+	    readXrefStreams(compressed);
+
+	std::map<int, std::pair<int, int> >::iterator cit;
+	for (cit=compressed.begin(); cit!=compressed.end(); cit++)
+	{
+	    if (!latest.count(cit->first))
+		return false;
+	}
+
+	return true;
+    }
+
+    void Parser::deduplicate(std::vector<Object*>& objects)
+    {
+	std::map<int, Object*> latest;
+	std::map<int, Object*> replacements;
+	std::vector<Object*>::iterator it;
+
+	for(it=objects.begin(); it!=objects.end(); it++)
+	    latest[(*it)->objectId()] = *it;
+
+	if (!canRewriteReferences(latest))
+	    return;
+
+	std::vector<DedupCandidate> candidates;
+	std::map<int, Object*>::iterator lit;
+	for (lit=latest.begin(); lit!=latest.end(); lit++)
+	{
+	    if (canDeduplicate(lit->second))
+		candidates.push_back(DedupCandidate(lit->second));
+	}
+
+	// Replacing references may make other objects identical
+	while (true)
+	{
+	    std::map<std::tuple<uint64_t, uint64_t, uint64_t, uint64_t>, std::vector<Object*> > canonicals;
+	    std::map<int, Object*> newReplacements;
+	    std::vector<DedupCandidate> remaining;
+	    std::vector<DedupCandidate>::iterator cit;
+
+	    for (cit=candidates.begin(); cit!=candidates.end(); cit++)
+	    {
+		std::vector<Object*>& sameHash = canonicals[cit->key()];
+		std::vector<Object*>::iterator canonical;
+		for (canonical=sameHash.begin(); canonical!=sameHash.end(); canonical++)
+		{
+		    if (sameContent(*canonical, cit->object))
+			break;
+		}
+
+		if (canonical == sameHash.end())
+		{
+		    sameHash.push_back(cit->object);
+		    remaining.push_back(*cit);
+		}
+		else
+		    newReplacements[cit->object->objectId()] = *canonical;
+	    }
+
+	    if (newReplacements.empty())
+		break;
+
+	    std::set<Object*> modified;
+	    for (lit=latest.begin(); lit!=latest.end(); lit++)
+	    {
+		if (!newReplacements.count(lit->first) && replaceReferences(lit->second, newReplacements))
+		{
+		    lit->second->update();
+		    modified.insert(lit->second);
+		}
+	    }
+	    replaceReferences(&trailer, newReplacements);
+
+	    // Only objects with replaced references need a new hash
+	    for (cit=remaining.begin(); cit!=remaining.end(); cit++)
+	    {
+		if (modified.count(cit->object))
+		    cit->hashHeader();
+	    }
+
+	    replacements.insert(newReplacements.begin(), newReplacements.end());
+	    candidates.swap(remaining);
+	}
+
+	if (replacements.empty())
+	    return;
+
+	std::vector<Object*> deduplicated;
+	for(it=objects.begin(); it!=objects.end(); it++)
+	{
+	    if (!replacements.count((*it)->objectId()))
+		deduplicated.push_back(*it);
+	}
+	objects.swap(deduplicated);
+    }
+
+    /**
+     * @brief Give ids firstId, firstId+1... (generation 0) to objects.
+     * Previous ids are added into replacements.
+     */
+    static void renumberObjects(std::vector<Object*>& objects, int firstId, std::map<int, Object*>& replacements)
+    {
+	for (unsigned int i=0; i<objects.size(); i++)
+	{
+	    Object* object = objects[i];
+	    replacements[object->objectId()] = object;
+	    object->setObjectId(firstId + i);
+	    object->setGenerationNumber(0);
+	    object->update();
+	}
+    }
+
+    void Parser::renumber(std::vector<Object*>& objects)
+    {
+	std::map<int, Object*> latest;
+	std::vector<Object*>::iterator it;
+
+	for(it=objects.begin(); it!=objects.end(); it++)
+	    latest[(*it)->objectId()] = *it;
+
+	if (!canRewriteReferences(latest))
+	    return;
+
+	// Keep last version of used objects. Old cross reference
+	// streams are not valid anymore.
+	std::vector<Object*> renumbered;
+	for(it=objects.begin(); it!=objects.end(); it++)
+	{
+	    if (latest[(*it)->objectId()] == *it && (*it)->used() && !isXrefStream(*it))
+		renumbered.push_back(*it);
+	}
+
+	std::map<int, Object*> replacements;
+	renumberObjects(renumbered, 1, replacements);
+	applyRenumbering(renumbered, replacements, renumbered.size());
+
+	objects.swap(renumbered);
+    }
+
+    void Parser::applyRenumbering(std::vector<Object*>& renumbered, std::map<int, Object*>& replacements,
+				  int maxId)
+    {
+	// Old ids of objects not renumbered (free, dangling, xref streams...)
+	// may now be used by another object
+	for (unsigned int i=0; i<renumbered.size(); i++)
+	    replaceReferences(renumbered[i], replacements, true);
+	replaceReferences(&trailer, replacements, true);
+
+	// Other objects have colliding ids : remove them from parser
+	std::set<Object*> kept(renumbered.begin(), renumbered.end());
+	std::vector<Object*> objects, dirty;
+
+	for (unsigned int i=0; i<_objects.size(); i++)
+	{
+	    if (kept.count(_objects[i]))
+		objects.push_back(_objects[i]);
+	    else
+		delete _objects[i];
+	}
+	for (unsigned int i=0; i<dirtyObjects.size(); i++)
+	{
+	    if (kept.count(dirtyObjects[i]))
+		dirty.push_back(dirtyObjects[i]);
+	}
+	_objects.swap(objects);
+	dirtyObjects.swap(dirty);
+
+	// Source file cross references are not valid anymore
+	_xrefTable.clear();
+	xrefObject = 0;
+	freeIds.clear();
+	maxObjectId = maxId;
+    }
+
+    /**
+     * @brief Return object pointed by data if it's a reference to a known object
+     */
+    static Object* referencedObject(DataType* data, std::map<int, Object*>& latest)
+    {
+	if (!data || data->type() != DataType::TYPE::REFERENCE)
+	    return 0;
+
+	std::map<int, Object*>::iterator it = latest.find(((Reference*)data)->value());
+	return (it == latest.end()) ? 0 : it->second;
+    }
+
+    /**
+     * @brief Walk page tree from node, pages are added in document order
+     */
+    static void collectPages(Object* node, std::map<int, Object*>& latest, std::set<int>& visited,
+			     std::vector<Object*>& treeNodes, std::vector<Object*>& pages)
+    {
+	if (!node || !visited.insert(node->objectId()).second)
+	    return;
+
+	if (node->hasKey("Type") && (*node)["Type"]->str() == "/Page")
+	{
+	    pages.push_back(node);
+	    return;
+	}
+
+	treeNodes.push_back(node);
+
+	if (!node->hasKey("Kids") || (*node)["Kids"]->type() != DataType::TYPE::ARRAY)
+	    return;
+
+	std::vector<DataType*>& kids = ((Array*)(*node)["Kids"])->value();
+	for (unsigned int i=0; i<kids.size(); i++)
+	    collectPages(referencedObject(kids[i], latest), latest, visited, treeNodes, pages);
+    }
+
+    /**
+     * @brief Objects of the document grouped by page
+     */
+    struct PageLayout
+    {
+	PageLayout():
+	    root(0)
+	{}
+
+	std::map<int, Object*> latest;
+	Object* root;
+	std::set<int> structure;                        // Catalog and page tree (nodes and pages)
+	std::vector<Object*> treeNodes, pages;
+	std::vector<std::vector<Object*> > pageObjects; // Objects first used by each page
+	std::vector<std::vector<int> > pageReferences;  // All objects used by each page
+	std::map<int, unsigned int> firstPage;
+	std::set<int> shared;                           // Objects used by several pages
+    };
+
+    /**
+     * @brief Find objects used by each page with a depth first walk
+     * that stops at page tree objects
+     *
+     * @return false if there is no page tree
+     */
+    static bool analyzePages(std::vector<Object*>& objects, Object& trailer, PageLayout& layout)
+    {
+	std::map<int, Object*>& latest = layout.latest;
+	std::vector<Object*>::iterator it;
+
+	for(it=objects.begin(); it!=objects.end(); it++)
+	    latest[(*it)->objectId()] = *it;
+
+	layout.root = trailer.hasKey("Root") ? referencedObject(trailer["Root"], latest) : 0;
+	if (!layout.root || !layout.root->hasKey("Pages"))
+	    return false;
+
+	layout.structure.insert(layout.root->objectId());
+	collectPages(referencedObject((*layout.root)["Pages"], latest), latest, layout.structure,
+		     layout.treeNodes, layout.pages);
+
+	unsigned int nbPages = layout.pages.size();
+	layout.pageObjects.resize(nbPages);
+	layout.pageReferences.resize(nbPages);
+
+	for (unsigned int page=0; page<nbPages; page++)
+	{
+	    std::set<int> seen;
+	    std::vector<int> toVisit;
+
+	    collectReferences(layout.pages[page], toVisit);
+	    std::reverse(toVisit.begin(), toVisit.end());
+
+	    while (!toVisit.empty())
+	    {
+		int id = toVisit.back();
+		toVisit.pop_back();
+
+		if (layout.structure.count(id) || !seen.insert(id).second)
+		    continue;
+
+		std::map<int, Object*>::iterator object = latest.find(id);
+		if (object == latest.end())
+		    continue;
+
+		layout.pageReferences[page].push_back(id);
+
+		std::map<int, unsigned int>::iterator first = layout.firstPage.find(id);
+		if (first == layout.firstPage.end())
+		{
+		    layout.firstPage[id] = page;
+		    layout.pageObjects[page].push_back(object->second);
+		}
+		else if (first->second != page)
+		    layout.shared.insert(id);
+
+		std::vector<int> references;
+		collectReferences(object->second, references);
+		toVisit.insert(toVisit.end(), references.rbegin(), references.rend());
+	    }
+	}
+
+	return true;
+    }
+
+    void Parser::orderByPage(std::vector<Object*>& objects)
+    {
+	PageLayout layout;
+	std::vector<Object*>::iterator it;
+
+	if (!analyzePages(objects, trailer, layout))
+	    return;
+
+	// Catalog and page tree nodes first
+	std::vector<Object*> ordered;
+	ordered.reserve(layout.latest.size());
+	ordered.push_back(layout.root);
+	ordered.insert(ordered.end(), layout.treeNodes.begin(), layout.treeNodes.end());
+
+	for (unsigned int page=0; page<layout.pages.size(); page++)
+	{
+	    ordered.push_back(layout.pages[page]);
+	    for (it=layout.pageObjects[page].begin(); it!=layout.pageObjects[page].end(); it++)
+	    {
+		if (!layout.shared.count((*it)->objectId()))
+		    ordered.push_back(*it);
+	    }
+	}
+
+	// Then objects shared by several pages
+	for (unsigned int page=0; page<layout.pages.size(); page++)
+	{
+	    for (it=layout.pageObjects[page].begin(); it!=layout.pageObjects[page].end(); it++)
+	    {
+		if (layout.shared.count((*it)->objectId()))
+		    ordered.push_back(*it);
+	    }
+	}
+
+	// And all others (last version only) in original order
+	for(it=objects.begin(); it!=objects.end(); it++)
+	{
+	    int id = (*it)->objectId();
+	    if (layout.latest[id] == *it && !layout.structure.count(id) && !layout.firstPage.count(id))
+		ordered.push_back(*it);
+	}
+
+	objects.swap(ordered);
+    }
+
+    /**
+     * @brief Bits writer for hint tables (most significant bit first)
+     */
+    class BitWriter
+    {
+    public:
+	BitWriter(std::string& data):
+	    data(data), current(0), nbBits(0)
+	{}
+
+	void write(uint64_t value, int bits)
+	{
+	    for (int i=bits-1; i>=0; i--)
+	    {
+		current = (current << 1) | ((value >> i) & 1);
+		if (++nbBits == 8)
+		{
+		    data += (char)current;
+		    current = 0;
+		    nbBits = 0;
+		}
+	    }
+	}
+
+	/**
+	 * @brief Complete current byte with zeros
+	 */
+	void flush()
+	{
+	    if (nbBits)
+		write(0, 8-nbBits);
+	}
+
+    private:
+	std::string& data;
+	unsigned char current;
+	int nbBits;
+    };
+
+    static int bitsNeeded(uint64_t value)
+    {
+	int res = 0;
+	while (value)
+	{
+	    res++;
+	    value >>= 1;
+	}
+	return res;
+    }
+
+    /**
+     * @brief Page offset and shared object hint tables
+     * Each page and each shared object group is described by
+     * its number of objects and its length.
+     */
+    static void writeHintTables(std::string& data, uint64_t& sharedTableOffset,
+				uint64_t firstPageOffset, std::vector<unsigned int>& pageObjects,
+				std::vector<uint64_t>& pageLengths, std::vector<std::vector<unsigned int> >& pageShared,
+				int firstSharedId, uint64_t firstSharedOffset, unsigned int nbFirstPageShared,
+				std::vector<uint64_t>& sharedLengths)
+    {
+	BitWriter writer(data);
+	unsigned int nbPages = pageObjects.size();
+
+	unsigned int minObjects = *std::min_element(pageObjects.begin(), pageObjects.end());
+	unsigned int maxObjects = *std::max_element(pageObjects.begin(), pageObjects.end());
+	uint64_t minLength = *std::min_element(pageLengths.begin(), pageLengths.end());
+	uint64_t maxLength = *std::max_element(pageLengths.begin(), pageLengths.end());
+	unsigned int maxShared = 0;
+	for (unsigned int page=0; page<nbPages; page++)
+	    maxShared = std::max(maxShared, (unsigned int)pageShared[page].size());
+
+	int objectsBits = bitsNeeded(maxObjects - minObjects);
+	int lengthBits = bitsNeeded(maxLength - minLength);
+	int sharedBits = bitsNeeded(maxShared);
+	int identifierBits = bitsNeeded(sharedLengths.size() ? sharedLengths.size()-1 : 0);
+
+	// Page offset hint table header
+	writer.write(minObjects, 32);
+	writer.write(firstPageOffset, 32);
+	writer.write(objectsBits, 16);
+	writer.write(minLength, 32);
+	writer.write(lengthBits, 16);
+	writer.write(0, 32);           // Content stream offset (from page start)
+	writer.write(0, 16);
+	writer.write(minLength, 32);   // Content stream length (whole page)
+	writer.write(lengthBits, 16);
+	writer.write(sharedBits, 16);
+	writer.write(identifierBits, 16);
+	writer.write(0, 16);           // Fractional position numerator
+	writer.write(1, 16);           // and denominator
+
+	// Entries, grouped by item
+	for (unsigned int page=0; page<nbPages; page++)
+	    writer.write(pageObjects[page] - minObjects, objectsBits);
+	writer.flush();
+	for (unsigned int page=0; page<nbPages; page++)
+	    writer.write(pageLengths[page] - minLength, lengthBits);
+	writer.flush();
+	for (unsigned int page=0; page<nbPages; page++)
+	    writer.write(pageShared[page].size(), sharedBits);
+	writer.flush();
+	for (unsigned int page=0; page<nbPages; page++)
+	{
+	    for (unsigned int i=0; i<pageShared[page].size(); i++)
+		writer.write(pageShared[page][i], identifierBits);
+	}
+	writer.flush();
+	for (unsigned int page=0; page<nbPages; page++)
+	    writer.write(pageLengths[page] - minLength, lengthBits);
+	writer.flush();
+
+	sharedTableOffset = data.size();
+
+	uint64_t minGroupLength = 0, maxGroupLength = 0;
+	if (sharedLengths.size())
+	{
+	    minGroupLength = *std::min_element(sharedLengths.begin(), sharedLengths.end());
+	    maxGroupLength = *std::max_element(sharedLengths.begin(), sharedLengths.end());
+	}
+	int groupLengthBits = bitsNeeded(maxGroupLength - minGroupLength);
+
+	// Shared object hint table header, one object per group
+	writer.write(firstSharedId, 32);
+	writer.write(firstSharedOffset, 32);
+	writer.write(nbFirstPageShared, 32);
+	writer.write(sharedLengths.size(), 32);
+	writer.write(0, 16);
+	writer.write(minGroupLength, 32);
+	writer.write(groupLengthBits, 16);
+
+	for (unsigned int i=0; i<sharedLengths.size(); i++)
+	    writer.write(sharedLengths[i] - minGroupLength, groupLengthBits);
+	writer.flush();
+	for (unsigned int i=0; i<sharedLengths.size(); i++)
+	    writer.write(0, 1);        // No MD5 signature
+	writer.flush();
+    }
+
+    bool Parser::writeLinearized(Sink& sink, std::vector<Object*>& objects)
+    {
+	PageLayout layout;
+	std::vector<Object*>::iterator it;
+
+	if (!analyzePages(objects, trailer, layout) || layout.pages.empty() ||
+	    !canRewriteReferences(layout.latest))
+	    return false;
+
+	std::vector<Object*>& pages = layout.pages;
+	unsigned int nbPages = pages.size();
+
+	// First page section: first page and all objects it uses
+	std::vector<Object*> firstPage(1, pages[0]);
+	firstPage.insert(firstPage.end(), layout.pageObjects[0].begin(), layout.pageObjects[0].end());
+
+	// Other pages, objects shared by them and all others
+	std::vector<Object*> others;
+	std::vector<unsigned int> pageStart(nbPages+1, 0);
+	for (unsigned int page=1; page<nbPages; page++)
+	{
+	    pageStart[page] = others.size();
+	    others.push_back(pages[page]);
+	    for (it=layout.pageObjects[page].begin(); it!=layout.pageObjects[page].end(); it++)
+	    {
+		if (!layout.shared.count((*it)->objectId()))
+		    others.push_back(*it);
+	    }
+	}
+
+	unsigned int sharedStart = others.size();
+	pageStart[nbPages] = sharedStart;
+	for (unsigned int page=1; page<nbPages; page++)
+	{
+	    for (it=layout.pageObjects[page].begin(); it!=layout.pageObjects[page].end(); it++)
+	    {
+		if (layout.shared.count((*it)->objectId()))
+		    others.push_back(*it);
+	    }
+	}
+	unsigned int sharedEnd = others.size();
+
+	others.insert(others.end(), layout.treeNodes.begin(), layout.treeNodes.end());
+	for(it=objects.begin(); it!=objects.end(); it++)
+	{
+	    int id = (*it)->objectId();
+	    if (layout.latest[id] == *it && (*it)->used() && !isXrefStream(*it) &&
+		!layout.structure.count(id) && !layout.firstPage.count(id))
+		others.push_back(*it);
+	}
+
+	// Objects of first page section are numbered after the others
+	std::map<int, Object*> replacements;
+	std::vector<Object*> catalog(1, layout.root);
+	int nbOthers = others.size();
+	int linearizationId = nbOthers + 1;
+	int hintId = nbOthers + 3;
+	int size = nbOthers + 4 + firstPage.size();
+
+	renumberObjects(others, 1, replacements);
+	renumberObjects(catalog, nbOthers + 2, replacements);
+	renumberObjects(firstPage, nbOthers + 4, replacements);
+
+	std::vector<Object*> renumbered(others);
+	renumbered.insert(renumbered.end(), catalog.begin(), catalog.end());
+	renumbered.insert(renumbered.end(), firstPage.begin(), firstPage.end());
+	applyRenumbering(renumbered, replacements, size - 1);
+
+	// Serialize body, offsets are relative to catalog
+	SegmentSink body;
+	std::vector<uint64_t> firstPageOffsets, otherOffsets;
+
+	layout.root->serialize(body);
+	uint64_t catalogEnd = body.offset();
+	for (it=firstPage.begin(); it!=firstPage.end(); it++)
+	{
+	    firstPageOffsets.push_back(body.offset());
+	    (*it)->serialize(body);
+	}
+	uint64_t firstPageEnd = body.offset();
+	firstPageOffsets.push_back(firstPageEnd);
+	for (it=others.begin(); it!=others.end(); it++)
+	{
+	    otherOffsets.push_back(body.offset());
+	    (*it)->serialize(body);
+	}
+	uint64_t bodyEnd = body.offset();
+	otherOffsets.push_back(bodyEnd);
+
+	// Linearization dictionary and first page trailer have a fixed size
+	// (padded with spaces) so that offsets can be computed before writing them
+	static const uint64_t MAX_VALUE = 999999999999ULL;
+
+	auto linearizationDict = [&](uint64_t fileLength, uint64_t hintOffset, uint64_t hintLength,
+				     uint64_t firstPageEnd, uint64_t mainXrefEntries) {
+	    return std::to_string(linearizationId) + " 0 obj\n<</Linearized 1/L " + std::to_string(fileLength) +
+	    "/H[ " + std::to_string(hintOffset) + " " + std::to_string(hintLength) + "]/O " +
+	    std::to_string(pages[0]->objectId()) + "/E " + std::to_string(firstPageEnd) +
+	    "/N " + std::to_string(nbPages) + "/T " + std::to_string(mainXrefEntries) + ">>";
+	};
+
+	auto firstPageXref = [&](uint64_t hintOffset, uint64_t hintLength, uint64_t mainXrefOffset,
+				 uint64_t catalogOffset, uint64_t linearizationOffset) {
+	    std::string res;
+	    StringSink out(res);
+	    std::vector<XRefValue> xref;
+
+	    xref.push_back(XRefValue(linearizationId, linearizationOffset, 0, true));
+	    xref.push_back(XRefValue(nbOthers + 2, catalogOffset, 0, true));
+	    xref.push_back(XRefValue(hintId, hintOffset, 0, true));
+	    for (unsigned int i=0; i<firstPage.size(); i++)
+		xref.push_back(XRefValue(firstPage[i]->objectId(),
+					 catalogOffset + hintLength + firstPageOffsets[i], 0, true));
+	    writeXref(out, xref, false);
+
+	    trailer.deleteKey("Prev");
+	    trailer.deleteKey("Size");
+	    trailer.deleteKey("XRefStm");
+	    trailer.dictionary().addData("Size", new Integer(size));
+	    trailer.dictionary().addData("Prev", new Integer(mainXrefOffset));
+	    out.append("trailer\n");
+	    trailer.dictionary().serialize(out);
+	    return res;
+	};
+
+	std::string header;
+	StringSink headerSink(header);
+	writeHeader(headerSink, 2);
+
+	std::string linearization = linearizationDict(MAX_VALUE, MAX_VALUE, MAX_VALUE, MAX_VALUE, MAX_VALUE);
+	std::string firstXref = firstPageXref(0, 0, MAX_VALUE, 0, 0);
+	size_t linearizationSize = linearization.size();
+	size_t firstXrefSize = firstXref.size();
+	static const char* firstXrefEnd = "\nstartxref\n0\n%%EOF\n";
+
+	uint64_t linearizationOffset = header.size();
+	uint64_t firstXrefOffset = linearizationOffset + linearizationSize + strlen("\nendobj\n");
+	uint64_t catalogOffset = firstXrefOffset + firstXrefSize + strlen(firstXrefEnd);
+
+	// Hint tables offsets are computed as if hint stream was not present
+	std::vector<unsigned int> pageObjects(nbPages);
+	std::vector<uint64_t> pageLengths(nbPages), sharedLengths;
+	std::vector<std::vector<unsigned int> > pageShared(nbPages);
+	std::map<int, unsigned int> sharedIndex;
+
+	for (unsigned int i=0; i<firstPage.size(); i++)
+	{
+	    sharedIndex[firstPage[i]->objectId()] = sharedLengths.size();
+	    sharedLengths.push_back(firstPageOffsets[i+1] - firstPageOffsets[i]);
+	}
+	for (unsigned int i=sharedStart; i<sharedEnd; i++)
+	{
+	    sharedIndex[others[i]->objectId()] = sharedLengths.size();
+	    sharedLengths.push_back(otherOffsets[i+1] - otherOffsets[i]);
+	}
+
+	pageObjects[0] = firstPage.size();
+	pageLengths[0] = firstPageEnd - catalogEnd;
+	for (unsigned int page=1; page<nbPages; page++)
+	{
+	    pageObjects[page] = pageStart[page+1] - pageStart[page];
+	    pageLengths[page] = otherOffsets[pageStart[page+1]] - otherOffsets[pageStart[page]];
+	}
+	for (unsigned int page=0; page<nbPages; page++)
+	{
+	    std::vector<int>& references = layout.pageReferences[page];
+	    for (unsigned int i=0; i<references.size(); i++)
+	    {
+		if (layout.shared.count(references[i]))
+		    pageShared[page].push_back(sharedIndex[replacements[references[i]]->objectId()]);
+	    }
+	}
+
+	std::string hints, compressedHints;
+	uint64_t sharedTableOffset;
+	writeHintTables(hints, sharedTableOffset, catalogOffset + catalogEnd, pageObjects, pageLengths, pageShared,
+			(sharedStart < sharedEnd) ? others[sharedStart]->objectId() : 0,
+			(sharedStart < sharedEnd) ? catalogOffset + otherOffsets[sharedStart] : 0,
+			firstPage.size(), sharedLengths);
+
+	Object* hintObject = newStreamObject(hintId, 0, hints, compressedHints);
+	hintObject->dictionary().addData("S", new Integer(sharedTableOffset));
+	std::string hintStream;
+	StringSink hintSink(hintStream);
+	hintObject->serialize(hintSink);
+	delete hintObject;
+
+	uint64_t hintOffset = catalogOffset + catalogEnd;
+	uint64_t hintLength = hintStream.size();
+	uint64_t mainXrefOffset = catalogOffset + hintLength + bodyEnd;
+
+	std::string mainXref;
+	StringSink mainXrefSink(mainXref);
+	std::vector<XRefValue> xref;
+	for (unsigned int i=0; i<others.size(); i++)
+	    xref.push_back(XRefValue(others[i]->objectId(), catalogOffset + hintLength + otherOffsets[i], 0, true));
+	writeXref(mainXrefSink, xref, true);
+
+	Dictionary mainTrailer;
+	mainTrailer.addData("Size", new Integer(nbOthers + 1));
+	mainXrefSink.append("trailer\n");
+	mainTrailer.serialize(mainXrefSink);
+	mainXrefSink.append("startxref\n");
+	mainXrefSink.appendInteger(firstXrefOffset);
+	mainXrefSink.append("\n%%EOF\n");
+
+	// Points to the end of line before first entry
+	uint64_t mainXrefEntries = mainXrefOffset + strlen("xref\n0 ") + std::to_string(nbOthers + 1).size();
+	uint64_t fileLength = mainXrefOffset + mainXref.size();
+
+	linearization = linearizationDict(fileLength, hintOffset, hintLength,
+					  catalogOffset + hintLength + firstPageEnd, mainXrefEntries);
+	linearization.append(linearizationSize - linearization.size(), ' ');
+	firstXref = firstPageXref(hintOffset, hintLength, mainXrefOffset, catalogOffset, linearizationOffset);
+	firstXref.append(firstXrefSize - firstXref.size(), ' ');
+	trailer.deleteKey("Prev");
+
+	sink.append(header);
+	sink.append(linearization);
+	sink.append("\nendobj\n");
+	sink.append(firstXref);
+	sink.append(firstXrefEnd);
+	body.replay(sink, 0, catalogEnd);
+	sink.append(hintStream);
+	body.replay(sink, catalogEnd, bodyEnd);
+	sink.append(mainXref);
+
+	return true;
+    }
+
+    /**
+     * @brief Return the only filter of stream object ("" if none)
+     */
+    static std::string singleFilter(Object* object)
+    {
+	DataType* filter = (*object)["Filter"];
+
+	if (filter->type() == DataType::TYPE::ARRAY && ((Array*)filter)->value().size() == 1)
+	    filter = ((Array*)filter)->value()[0];
+
+	if (filter->type() != DataType::TYPE::NAME)
+	    return "";
+
+	return filter->str();
+    }
+
+    void Parser::compressStreams(std::vector<Object*>& objects, const WriteOptions& options,
+				 unsigned int nbThreads)
+    {
+	std::vector<Object*> toCompress;
+
+	// Filters apply on decrypted data
+	if (!Flate::available() || trailer.hasKey("Encrypt"))
+	    return;
+
+	for (auto object : objects)
+	{
+	    Stream* stream = getStream(object);
+
+	    if (!stream || !stream->dataLength())
+		continue;
+
+	    if (object->hasKey("Type"))
+	    {
+		std::string type = (*object)["Type"]->str();
+		if (type == "/XRef" || type == "/Metadata")
+		    continue;
+	    }
+
+	    if (object->hasKey("Filter"))
+	    {
+		if (!options.recompressStreams || singleFilter(object) != "/FlateDecode")
+		    continue;
+	    }
+	    else if (!options.compressStreams)
+		continue;
+
+	    toCompress.push_back(object);
+	}
+
+	// Only one decoded stream per thread is in memory. Parser dirty set
+	// is not thread safe : objects are marked updated at the end.
+	std::vector<char> bigStreams(toCompress.size()), modified(toCompress.size());
+	auto compress = [&](unsigned int i, unsigned int threads) {
+	    Object* object = toCompress[i];
+	    Stream* stream = getStream(object);
+	    Dictionary& dict = object->dictionary();
+	    std::string data, compressed;
+
+	    decodeStream(object, stream, data);
+	    Flate::compress((const unsigned char*)data.c_str(), data.size(),
+			    compressed, options.compressionLevel, threads);
+
+	    // Recompressed streams keep their filter (and DecodeParms)
+	    if (!dict.hasKey("Filter"))
+	    {
+		if (compressed.size() >= stream->dataLength())
+		    return;
+		dict.addData("Filter", new Name("/FlateDecode"));
+	    }
+
+	    unsigned char* newData = new unsigned char[compressed.size()];
+	    memcpy(newData, compressed.c_str(), compressed.size());
+	    stream->setData(newData, compressed.size(), true);
+
+	    dict.deleteKey("Length");
+	    dict.addData("Length", new Integer(compressed.size()));
+	    modified[i] = 1;
+	};
+
+	// Big streams are compressed one by one using all threads
+	for (unsigned int i=0; i<toCompress.size(); i++)
+	{
+	    if (nbThreads > 1 && getStream(toCompress[i])->dataLength() >= nbThreads * Flate::BLOCK_SIZE)
+	    {
+		bigStreams[i] = 1;
+		compress(i, nbThreads);
+	    }
+	}
+
+	// Small ones are distributed between threads
+	parallelFor(toCompress.size(), nbThreads,
+		    [&](unsigned int, unsigned int begin, unsigned int end) {
+			for (unsigned int i=begin; i<end; i++)
+			{
+			    if (!bigStreams[i])
+				compress(i, 1);
+			}
+		    });
+
+	for (unsigned int i=0; i<toCompress.size(); i++)
+	{
+	    if (modified[i])
+		toCompress[i]->update();
+	}
+    }
+
+    void Parser::write(const std::string& filename, bool update)
+    {
+	if (update)
+	    return writeUpdate(filename);
+
+	write(filename, WriteOptions());
+    }
+
+    void Parser::write(const std::string& filename, const WriteOptions& options)
+    {
+	int newFd = open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+
+	if (newFd <= 0)
+	    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to open " << filename << " (%m)");
+
+	try
+	{
+	    FileSink sink(newFd);
+
+	    unsigned int nbThreads = options.threads;
+	    if (!nbThreads)
+		nbThreads = std::max(std::thread::hardware_concurrency(), 1U);
+
+	    std::vector<Object*> objects;
+	    if (!options.removeUnused || !reachableObjects(objects))
+		objects = _objects;
+
+	    if (options.deduplicate)
+		deduplicate(objects);
+
+	    if (options.pageOrder)
+		orderByPage(objects);
+
+	    if (options.renumber)
+		renumber(objects);
+
+	    if (options.compressStreams || options.recompressStreams)
+		compressStreams(objects, options, nbThreads);
+
+	    if (!options.linearize || !writeLinearized(sink, objects))
+	    {
+		if (options.xrefStream)
+		    writeCompressed(sink, objects, nbThreads);
+		else
+		    writeTable(sink, objects, nbThreads);
+	    }
+
+	    sink.flush();
+	}
+	catch (...)
+	{
+	    close(newFd);
+	    throw;
+	}
 	
-	close(newFd);
+	if (close(newFd))
+	    EXCEPTION(UNABLE_TO_WRITE_FILE, "Unable to close file (%m)");
     }
 }
@@ -0,0 +1,406 @@
+/*
+  Copyright 2021 Grégory Soutadé
+
+  This file is part of uPDFParser.
+
+  uPDFParser is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  uPDFParser is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with uPDFParser. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#endif
+
+#include "uPDFSink.h"
+#include "uPDFParser_common.h"
+
+namespace uPDFParser
+{
+    void readFully(int fd, char* buffer, size_t length, uint64_t offset)
+    {
+	ssize_t ret;
+
+	while (length)
+	{
+	    ret = ::pread(fd, buffer, length, offset);
+
+	    if (ret < 0 && errno == EINTR)
+		continue;
+
+	    if (ret <= 0)
+		EXCEPTION(TRUNCATED_FILE, "Unable to read " << length << " bytes at offset " << offset);
+
+	    buffer += ret;
+	    length -= ret;
+	    offset += ret;
+	}
+    }
+
+    void SegmentSink::writeData(const char* data, size_t length)
+    {
+	// Merge with previous in memory segment
+	if (segments.empty() || segments.back().fd || segments.back().reader)
+	{
+	    Segment segment = {_offset, 0, buffer.size(), 0, nullptr};
+	    segments.push_back(segment);
+	}
+
+	buffer.append(data, length);
+	segments.back().length += length;
+    }
+
+    void SegmentSink::copyData(int fd, uint64_t offset, uint64_t length)
+    {
+	Segment segment = {_offset, fd, offset, length, nullptr};
+	segments.push_back(segment);
+
+	readFully(fd, &_last, 1, offset + length - 1);
+    }
+
+    void SegmentSink::readData(const Reader& reader, uint64_t length)
+    {
+	Segment segment = {_offset, 0, 0, length, reader};
+	segments.push_back(segment);
+
+	// Not read yet
+	_last = '\0';
+    }
+
+    /**
+     * @brief Append length bytes given by reader starting at offset into sink
+     */
+    static void appendRange(Sink& sink, const Sink::Reader& reader, uint64_t offset, uint64_t length)
+    {
+	char buffer[64*1024];
+	size_t size;
+
+	while (length)
+	{
+	    size = reader(buffer, (length > sizeof(buffer)) ? sizeof(buffer) : length, offset);
+	    if (!size || size > length)
+		EXCEPTION(TRUNCATED_FILE, "Unable to read " << length << " bytes at offset " << offset);
+	    sink.append(buffer, size);
+	    offset += size;
+	    length -= size;
+	}
+    }
+
+    void SegmentSink::replay(Sink& sink, uint64_t from, uint64_t to)
+    {
+	// Find segment containing from
+	std::vector<Segment>::iterator it = std::upper_bound(
+	    segments.begin(), segments.end(), from,
+	    [](uint64_t offset, const Segment& segment) {return offset < segment.offset;});
+
+	if (it != segments.begin())
+	    it--;
+
+	for (; it != segments.end() && it->offset < to; it++)
+	{
+	    uint64_t start = (from > it->offset) ? from - it->offset : 0;
+	    uint64_t end = (to < it->offset + it->length) ? to - it->offset : it->length;
+
+	    if (start >= end)
+		continue;
+
+	    if (it->fd)
+		sink.copyFrom(it->fd, it->dataOffset + start, end - start);
+	    else if (it->reader)
+		appendRange(sink, it->reader, start, end - start);
+	    else
+		sink.append(&buffer[it->dataOffset + start], end - start);
+	}
+    }
+
+    void CompareSink::writeData(const char* data, size_t length)
+    {
+	size_t size;
+
+	if (!_equal || position + length > reference.offset())
+	{
+	    _equal = false;
+	    return;
+	}
+
+	while (length)
+	{
+	    size = (length > COMPARE_SIZE) ? COMPARE_SIZE : length;
+	    block.clear();
+	    StringSink sink(block);
+	    reference.replay(sink, position, position + size);
+
+	    if (memcmp(block.data(), data, size))
+	    {
+		_equal = false;
+		return;
+	    }
+
+	    data += size;
+	    position += size;
+	    length -= size;
+	}
+    }
+
+    void CompareSink::copyData(int fd, uint64_t offset, uint64_t length)
+    {
+	// Don't read data once a difference has been found
+	if (!_equal || position + length > reference.offset())
+	{
+	    _equal = false;
+	    return;
+	}
+
+	Sink::copyData(fd, offset, length);
+    }
+
+    void CompareSink::readData(const Reader& reader, uint64_t length)
+    {
+	// Don't read data once a difference has been found
+	if (!_equal || position + length > reference.offset())
+	{
+	    _equal = false;
+	    return;
+	}
+
+	Sink::readData(reader, length);
+    }
+
+    /**
+     * @brief Copy data between two files without going through user space
+     * (copy_file_range, then sendfile). offset and length are updated with
+     * what has been copied.
+     *
+     * @return false if kernel copy is not supported for these files
+     */
+    static bool kernelCopy(int inFd, uint64_t& offset, int outFd, uint64_t& length)
+    {
+#if defined(__linux__)
+	ssize_t ret;
+	bool useSendfile = false;
+
+	while (length)
+	{
+	    if (useSendfile)
+	    {
+		off_t inOffset = offset;
+		ret = ::sendfile(outFd, inFd, &inOffset, length);
+	    }
+	    else
+	    {
+		loff_t inOffset = offset;
+		ret = ::copy_file_range(inFd, &inOffset, outFd, NULL, length, 0);
+	    }
+
+	    if (ret < 0)
+	    {
+		if (errno == EINTR)
+		    continue;
+		// Not supported (old kernel, different filesystems, O_APPEND...)
+		if (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+		    errno == EBADF || errno == EOPNOTSUPP)
+		{
+		    if (useSendfile)
+			return false;
+		    useSendfile = true;
+		    continue;
+		}
+		EXCEPTION(UNABLE_TO_WRITE_FILE, "Unable to copy file (" << strerror(errno) << ")");
+	    }
+
+	    if (ret == 0)
+		EXCEPTION(TRUNCATED_FILE, "Unable to read " << length << " bytes at offset " << offset);
+
+	    offset += ret;
+	    length -= ret;
+	}
+
+	return true;
+#else
+	(void)inFd; (void)offset; (void)outFd; (void)length;
+	return false;
+#endif
+    }
+
+    void Sink::copyData(int fd, uint64_t offset, uint64_t length)
+    {
+	char buffer[64*1024];
+	size_t size;
+
+	while (length)
+	{
+	    size = (length > sizeof(buffer)) ? sizeof(buffer) : length;
+	    readFully(fd, buffer, size, offset);
+	    writeData(buffer, size);
+	    offset += size;
+	    length -= size;
+	}
+
+	_last = buffer[size-1];
+    }
+
+    void Sink::readData(const Reader& reader, uint64_t length)
+    {
+	char buffer[64*1024];
+	uint64_t offset = 0;
+	size_t size = 0;
+
+	while (offset < length)
+	{
+	    size = reader(buffer, (length - offset > sizeof(buffer)) ? sizeof(buffer) : length - offset, offset);
+	    if (!size || size > length - offset)
+		EXCEPTION(TRUNCATED_FILE, "Unable to read " << (length - offset) << " bytes at offset " << offset);
+	    writeData(buffer, size);
+	    offset += size;
+	}
+
+	_last = buffer[size-1];
+    }
+
+    FileSink::FileSink(int fd, uint64_t offset, size_t bufferSize):
+	fd(fd), bufferSize(bufferSize), used(0)
+    {
+	_offset = offset;
+	buffer = new char[bufferSize];
+    }
+
+    FileSink::~FileSink()
+    {
+	delete[] buffer;
+    }
+
+    void FileSink::writeFully(struct iovec* iov, int iovcnt)
+    {
+	ssize_t ret;
+
+	while (iovcnt)
+	{
+	    ret = ::writev(fd, iov, iovcnt);
+
+	    if (ret < 0)
+	    {
+		if (errno == EINTR)
+		    continue;
+		EXCEPTION(UNABLE_TO_WRITE_FILE, "Unable to write file (" << strerror(errno) << ")");
+	    }
+
+	    // Skip what has been written (partial write)
+	    while (iovcnt && (size_t)ret >= iov->iov_len)
+	    {
+		ret -= iov->iov_len;
+		iov++;
+		iovcnt--;
+	    }
+
+	    if (iovcnt)
+	    {
+		iov->iov_base = (char*)iov->iov_base + ret;
+		iov->iov_len -= ret;
+	    }
+	}
+    }
+
+    void FileSink::flush()
+    {
+	if (!used)
+	    return;
+
+	struct iovec iov = {buffer, used};
+	writeFully(&iov, 1);
+	used = 0;
+    }
+
+    void FileSink::writeData(const char* data, size_t length)
+    {
+	if (used + length <= bufferSize)
+	{
+	    memcpy(&buffer[used], data, length);
+	    used += length;
+	    return;
+	}
+
+	// Too big : write buffer and data in one call
+	struct iovec iov[2] = {{buffer, used}, {(void*)data, length}};
+	writeFully(iov, 2);
+	used = 0;
+    }
+
+    void FileSink::copyData(int fd, uint64_t offset, uint64_t length)
+    {
+	size_t size;
+
+	// Big chunk : let the kernel do the copy
+	if (length >= KERNEL_COPY_THRESHOLD)
+	{
+	    uint64_t lastOffset = offset + length - 1;
+
+	    flush();
+	    if (kernelCopy(fd, offset, this->fd, length))
+	    {
+		readFully(fd, &_last, 1, lastOffset);
+		return;
+	    }
+	}
+
+	// Read directly into our buffer
+	while (length)
+	{
+	    if (used == bufferSize)
+		flush();
+
+	    size = bufferSize - used;
+	    if (size > length)
+		size = length;
+	    readFully(fd, &buffer[used], size, offset);
+	    used += size;
+	    offset += size;
+	    length -= size;
+	}
+
+	_last = buffer[used-1];
+    }
+
+    void FileSink::copyFile(int fd, uint64_t length)
+    {
+	if (!length) return;
+
+	flush();
+
+#if defined(__linux__)
+	struct stat _stat;
+
+	// Reflink : share source blocks (only for whole files)
+	if (_offset == 0 && !fstat(fd, &_stat) && (uint64_t)_stat.st_size == length &&
+	    ioctl(this->fd, FICLONE, fd) == 0)
+	{
+	    if (lseek(this->fd, length, SEEK_SET) != (off_t)length)
+		EXCEPTION(UNABLE_TO_WRITE_FILE, "Unable to seek output file (" << strerror(errno) << ")");
+	    _offset += length;
+	    readFully(fd, &_last, 1, length - 1);
+	    return;
+	}
+
+	// Error not fatal, copy will fail if there is really no space left
+	fallocate(this->fd, 0, _offset, length);
+#endif
+
+	copyFrom(fd, 0, length);
+    }
+}
@@ -17,10 +17,15 @@
   along with uPDFParser. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <algorithm>
+#include <charconv>
 
 #include "uPDFTypes.h"
+#include "uPDFObject.h"
 #include "uPDFParser_common.h"
 
 namespace uPDFParser
@@ -31,10 +36,209 @@ namespace uPDFParser
 	_value = name;
     }
 
-    String::String(const std::string& value):
-	DataType(DataType::TYPE::STRING)
+    String::String(const std::string& value, bool hasEscapes):
+	DataType(DataType::TYPE::STRING), _value(value), _hasEscapes(hasEscapes)
+    {}
+
+    /**
+     * @brief Return next c in [cur, end[ (end if none)
+     */
+    static inline const char* findChar(const char* cur, const char* end, char c)
     {
-	_value = value;
+	const char* res = (const char*)memchr(cur, c, end - cur);
+	return res ? res : end;
+    }
+
+    /**
+     * @brief Decode escapes and end of lines of a literal string, decoded
+     * data is given by spans to output(data, length)
+     */
+    template <typename Output>
+    static void decodeLiteral(const std::string& value, Output output)
+    {
+	const char* cur = value.c_str();
+	const char* end = cur + value.size();
+	const char* nextBackslash = findChar(cur, end, '\\');
+	const char* nextCR = findChar(cur, end, '\r');
+	char c;
+
+	while (cur < end)
+	{
+	    // Give bytes that don't need decoding at once
+	    if (nextBackslash < cur) nextBackslash = findChar(cur, end, '\\');
+	    if (nextCR < cur) nextCR = findChar(cur, end, '\r');
+
+	    const char* special = std::min(nextBackslash, nextCR);
+	    if (special > cur)
+		output(cur, special - cur);
+	    cur = special;
+
+	    if (cur == end)
+		break;
+
+	    // Unescaped end of line (\r or \r\n) is read as \n
+	    if (*cur++ == '\r')
+	    {
+		if (cur < end && *cur == '\n')
+		    cur++;
+		c = '\n';
+		output(&c, 1);
+		continue;
+	    }
+
+	    if (cur == end)
+		break;
+
+	    switch (*cur)
+	    {
+	    case 'n': c = '\n'; cur++; break;
+	    case 'r': c = '\r'; cur++; break;
+	    case 't': c = '\t'; cur++; break;
+	    case 'b': c = '\b'; cur++; break;
+	    case 'f': c = '\f'; cur++; break;
+	    // Line continuation
+	    case '\r':
+		cur++;
+		if (cur < end && *cur == '\n')
+		    cur++;
+		continue;
+	    case '\n': cur++; continue;
+	    case '0': case '1': case '2': case '3':
+	    case '4': case '5': case '6': case '7':
+	    {
+		// Up to 3 octal digits, overflow is ignored
+		int value = 0;
+		for (int i=0; i<3 && cur < end && *cur >= '0' && *cur <= '7'; i++)
+		    value = value * 8 + (*cur++ - '0');
+		c = (char)(value & 0xFF);
+		break;
+	    }
+	    // '(', ')', '\\' and unknown escapes : backslash is ignored
+	    default: c = *cur++; break;
+	    }
+
+	    output(&c, 1);
+	}
+    }
+
+    std::string String::unescapedValue()
+    {
+	if (!_hasEscapes)
+	    return _value;
+
+	std::string res;
+	res.reserve(_value.size());
+
+	decodeLiteral(_value, [&res](const char* data, size_t length) {
+		res.append(data, length);
+	    });
+
+	return res;
+    }
+
+    /**
+     * @brief Size of byte c in a literal string (escape included)
+     */
+    static inline int literalSize(unsigned char c)
+    {
+	switch (c)
+	{
+	case '(': case ')': case '\\':
+	case '\n': case '\r': case '\t': case '\b': case '\f':
+	    return 2;
+	default:
+	    // Other control characters : octal escape
+	    return (c < 0x20 || c == 0x7F) ? 4 : 1;
+	}
+    }
+
+    /**
+     * @brief Append literal string escape of c into sink
+     */
+    static inline void appendEscape(Sink& sink, unsigned char c, int size)
+    {
+	char escape[4] = {'\\', (char)c, 0, 0};
+
+	switch (c)
+	{
+	case '\n': escape[1] = 'n'; break;
+	case '\r': escape[1] = 'r'; break;
+	case '\t': escape[1] = 't'; break;
+	case '\b': escape[1] = 'b'; break;
+	case '\f': escape[1] = 'f'; break;
+	default:
+	    if (size == 4)
+	    {
+		escape[1] = '0' + (c >> 6);
+		escape[2] = '0' + ((c >> 3) & 7);
+		escape[3] = '0' + (c & 7);
+	    }
+	}
+
+	sink.append(escape, size);
+    }
+
+    void String::serialize(Sink& sink)
+    {
+	// Decoded value is never stored : stored one is read once to choose
+	// output format, then once again to write it
+	auto forEachSpan = [this](auto output) {
+	    if (_hasEscapes)
+		decodeLiteral(_value, output);
+	    else
+		output(_value.c_str(), _value.size());
+	};
+
+	size_t length = 0, literalLength = 0;
+	forEachSpan([&](const char* data, size_t size) {
+		length += size;
+		for (size_t i=0; i<size; i++)
+		    literalLength += literalSize(data[i]);
+	    });
+
+	// Binary data
+	if (literalLength > 2*length)
+	{
+	    static const char hex[] = "0123456789ABCDEF";
+	    char buffer[4096];
+
+	    sink.append('<');
+	    forEachSpan([&](const char* data, size_t size) {
+		    const unsigned char* bytes = (const unsigned char*)data;
+		    for (size_t i=0; i<size; )
+		    {
+			size_t used = 0;
+			for (; i<size && used < sizeof(buffer); i++)
+			{
+			    buffer[used++] = hex[bytes[i] >> 4];
+			    buffer[used++] = hex[bytes[i] & 0x0F];
+			}
+			sink.append(buffer, used);
+		    }
+		});
+	    sink.append('>');
+	    return;
+	}
+
+	sink.append('(');
+
+	// Copy spans without escapes at once
+	forEachSpan([&](const char* data, size_t size) {
+		size_t spanStart = 0;
+		for (size_t i=0; i<size && literalLength != length; i++)
+		{
+		    int escapeSize = literalSize(data[i]);
+		    if (escapeSize == 1)
+			continue;
+
+		    sink.append(&data[spanStart], i - spanStart);
+		    spanStart = i + 1;
+		    appendEscape(sink, data[i], escapeSize);
+		}
+		sink.append(&data[spanStart], size - spanStart);
+	    });
+
+	sink.append(')');
     }
 
     HexaString::HexaString(const std::string& value):
@@ -43,42 +247,49 @@ namespace uPDFParser
 	_value = value;
     }
 
-    std::string Integer::str()
+    void Integer::serialize(Sink& sink)
     {
-	std::string sign("");
+	sink.append(' ');
 	// Sign automatically added for negative numbers
 	if (_signed && _value >= 0)
-	    sign = "+";
+	    sink.append('+');
 
-	return " " + sign + std::to_string(_value);
+	sink.appendInteger(_value);
     }
     
-    std::string Real::str()
+    void Real::serialize(Sink& sink)
     {
-	std::string res;
-	std::string sign("");
+	// Fixed notation of the biggest double is ~310 characters
+	char buffer[512];
+	char* cur = buffer;
+
+	*cur++ = ' ';
 	if (_signed && _value >= 0)
-	    sign = "+";
+	    *cur++ = '+';
 
-	res = " " + sign + std::to_string(_value);
-	std::replace( res.begin(), res.end(), ',', '.');
+	// Shortest representation that gives back the same value,
+	// PDF doesn't support exponent
+	std::to_chars_result res = std::to_chars(cur, buffer + sizeof(buffer), _value,
+						 std::chars_format::fixed);
+	if (res.ec != std::errc())
+	    EXCEPTION(INVALID_NUMBER, "Unable to format real " << _value);
 
-	return res;
+	sink.append(buffer, res.ptr - buffer);
     }
 
-    std::string Array::str()
+    void Array::serialize(Sink& sink)
     {
-	std::string res("[");
 	std::vector<DataType*>::iterator it;
 
+	sink.append('[');
 	for(it = _value.begin(); it!=_value.end(); it++)
 	{
-	    if (res.size() > 1)
-		res += " ";
-	    res += (*it)->str();
+	    if (it != _value.begin())
+		sink.append(' ');
+	    (*it)->serialize(sink);
 	}
 	    
-	return res + "]";
+	sink.append(']');
     }
 
     void Dictionary::addData(const std::string& key, DataType* value)
@@ -86,64 +297,232 @@ namespace uPDFParser
 	_value[key] = value;
     }
     
-    std::string Dictionary::str()
+    void Dictionary::serialize(Sink& sink)
     {
-	std::string res("<<");
 	std::map<std::string, DataType*>::iterator it;
 	
+	sink.append("<<");
 	for(it = _value.begin(); it!=_value.end(); it++)
 	{
-	    res += std::string("/") + it->first;
+	    sink.append('/');
+	    sink.append(it->first);
 	    if (it->second)
-		res += it->second->str();
+		it->second->serialize(sink);
 	}
 	    
-	return res + std::string(">>\n"); 
-   }
+	sink.append(">>\n");
+    }
 
-    std::string Stream::str()
+    void Stream::serialize(Sink& sink)
     {
-	std::string res = "stream\n";
+	sink.append("stream\n");
+
+	// Generated while writing (or replaying SegmentSink)
+	if (generator)
+	{
+	    sink.appendFrom([this](char* buffer, size_t size, uint64_t offset) {
+		    size_t res = generator((unsigned char*)buffer, size, offset);
+		    if (!res || res > size)
+			EXCEPTION(INVALID_STREAM, "Stream generator returned " << res << " bytes, " << size << " expected");
+		    return res;
+		}, _dataLength);
+
+	    // Last byte is not known before generation, always add a line return
+	    if (_dataLength)
+		sink.append('\n');
+	    sink.append("endstream\n");
+	    return;
+	}
+
+	// Not in memory : direct copy from source file
+	if (!_data && fd)
+	{
+	    sink.copyFrom(fd, startOffset, endOffset - startOffset);
+	    if (endOffset > startOffset &&
+		sink.last() != '\n' &&
+		sink.last() != '\r')
+		sink.append('\n');
+	    sink.append("endstream\n");
+	    return;
+	}
+
 	const char* streamData = (const char*)data(); // Force reading if not in memory
-	res += std::string(streamData, _dataLength);
+	// Not copied by SegmentSink
+	sink.appendFrom([streamData](char* buffer, size_t size, uint64_t offset) {
+		memcpy(buffer, streamData + offset, size);
+		return size;
+	    }, _dataLength);
 	// Be sure there is a final line return
 	if (_dataLength &&
 	    streamData[_dataLength-1] != '\n' &&
 	    streamData[_dataLength-1] != '\r')
-	    res += "\n";
-	res += "endstream\n";
+	    sink.append('\n');
+	sink.append("endstream\n");
+    }
+    
+    void Stream::setOwner(Object* owner)
+    {
+	this->owner = owner;
+	dict = &owner->dictionary();
+    }
+
+    DataType* Stream::clone()
+    {
+	Stream* res = new Stream(*dict, startOffset, endOffset, 0, _dataLength, false, fd);
+
+	// Clone must stay valid when this stream is deleted
+	if (_data && freeData)
+	{
+	    res->_data = new unsigned char[_dataLength];
+	    res->freeData = true;
+	    memcpy(res->_data, _data, _dataLength);
+	}
+	else
+	    res->_data = _data;
+
+	if (ownFd)
+	{
+	    res->fd = dup(fd);
+	    if (res->fd < 0)
+	    {
+		res->fd = 0;
+		delete res;
+		EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to duplicate stream file descriptor (%m)");
+	    }
+	    res->ownFd = true;
+	}
+
+	res->generator = generator;
 
 	return res;
     }
-    
-    unsigned char* Stream::data()
+
+    void Stream::readInto(unsigned char* buffer)
     {
-	if (!_data)
+	if (generator)
+	{
+	    for (size_t pos = 0; pos < _dataLength; )
+	    {
+		size_t size = generator(&buffer[pos], _dataLength - pos, pos);
+		if (!size || size > _dataLength - pos)
+		    EXCEPTION(INVALID_STREAM, "Stream generator returned " << size << " bytes, " << (_dataLength - pos) << " expected");
+		pos += size;
+	    }
+	}
+	else
 	{
 	    if (!fd)
 		EXCEPTION(INVALID_STREAM, "Accessing data, but no file descriptor supplied");
 
-	    _dataLength = endOffset - startOffset;
-	    _data = new unsigned char[_dataLength];
-	    freeData = true;
+	    readFully(fd, (char*)buffer, endOffset - startOffset, startOffset);
+	}
+    }
 
-	    lseek(fd, startOffset, SEEK_SET);
-	    int ret = ::read(fd, _data, _dataLength);
+    unsigned char* Stream::data()
+    {
+	if (!_data)
+	{
+	    size_t length = dataLength();
+	    unsigned char* buffer = new unsigned char[length];
 
-	    if ((unsigned int)ret != _dataLength)
-		EXCEPTION(INVALID_STREAM, "Not enough data to read (" << ret << ")");
+	    try
+	    {
+		readInto(buffer);
+	    }
+	    catch (...)
+	    {
+		delete[] buffer;
+		throw;
+	    }
+
+	    // Now in memory
+	    _data = buffer;
+	    _dataLength = length;
+	    freeData = true;
+	    generator = nullptr;
 	}
 	
 	return _data;
     }
 
-    void Stream::setData(unsigned char* data, unsigned int dataLength, bool freeData)
+    void Stream::readData(std::string& res)
     {
-	if (_data && freeData)
-	    delete[] _data;
+	if (_data)
+	    res.assign((const char*)_data, _dataLength);
+	else
+	{
+	    res.resize(dataLength());
+	    readInto((unsigned char*)&res[0]);
+	}
+    }
+
+    void Stream::setData(unsigned char* data, size_t dataLength, bool freeData)
+    {
+	releaseData();
 	
 	this->_data = data;
 	this->_dataLength = dataLength;
 	this->freeData = freeData;
     }
+
+    void Stream::setData(int fd, off_t offset, size_t length)
+    {
+	releaseData();
+
+	this->fd = fd;
+	startOffset = offset;
+	endOffset = offset + length;
+	_dataLength = length;
+	setLength(length);
+    }
+
+    void Stream::setData(const std::string& filename)
+    {
+	struct stat _stat;
+	int newFd = open(filename.c_str(), O_RDONLY);
+
+	if (newFd <= 0)
+	    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to open " << filename << " (%m)");
+
+	if (fstat(newFd, &_stat))
+	{
+	    close(newFd);
+	    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to stat " << filename << " (%m)");
+	}
+
+	setData(newFd, 0, _stat.st_size);
+	ownFd = true;
+    }
+
+    void Stream::setData(const Generator& generator, size_t length)
+    {
+	releaseData();
+
+	this->generator = generator;
+	_dataLength = length;
+	setLength(length);
+    }
+
+    void Stream::releaseData()
+    {
+	if (_data && freeData)
+	    delete[] _data;
+	if (ownFd)
+	    close(fd);
+
+	_data = 0;
+	_dataLength = 0;
+	freeData = false;
+	ownFd = false;
+	generator = nullptr;
+    }
+
+    void Stream::setLength(size_t length)
+    {
+	dict->deleteKey("Length");
+	dict->addData("Length", new Integer(length));
+
+	if (owner)
+	    owner->update();
+    }
 }
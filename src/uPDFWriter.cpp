@@ -0,0 +1,129 @@
+/*
+  Copyright 2021 Grégory Soutadé
+
+  This file is part of uPDFParser.
+
+  uPDFParser is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  uPDFParser is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with uPDFParser. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "uPDFWriter.h"
+#include "uPDFParser.h"
+#include "uPDFParser_common.h"
+
+namespace uPDFParser
+{
+    Writer::Writer(const std::string& filename, int version_major, int version_minor):
+	fd(0), sink(0), offsets(1, 0)
+    {
+	fd = open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+
+	if (fd <= 0)
+	    EXCEPTION(UNABLE_TO_OPEN_FILE, "Unable to open " << filename << " (%m)");
+
+	sink = new FileSink(fd);
+
+	Parser::writeHeader(*sink, version_major, version_minor);
+    }
+
+    Writer::~Writer()
+    {
+	// Not closed : file is incomplete
+	if (sink)
+	{
+	    try
+	    {
+		sink->flush();
+	    }
+	    catch (...)
+	    {}
+	    delete sink;
+	}
+
+	if (fd)
+	    ::close(fd);
+    }
+
+    int Writer::reserve()
+    {
+	offsets.push_back(0);
+	reserved.insert(offsets.size() - 1);
+	return offsets.size() - 1;
+    }
+
+    int Writer::write(Object& object)
+    {
+	if (!sink)
+	    EXCEPTION(UNABLE_TO_WRITE_FILE, "Writer is closed");
+
+	if (!object.objectId())
+	    object.setObjectId(reserve());
+	else if ((unsigned int)object.objectId() >= offsets.size())
+	    offsets.resize(object.objectId()+1, 0);
+
+	if (offsets[object.objectId()])
+	    EXCEPTION(INVALID_OBJECT, "Object " << object.objectId() << " already written");
+
+	object.setGenerationNumber(0);
+	offsets[object.objectId()] = sink->offset();
+	reserved.erase(object.objectId());
+	object.serialize(*sink);
+
+	return object.objectId();
+    }
+
+    void Writer::close()
+    {
+	if (!sink)
+	    EXCEPTION(UNABLE_TO_WRITE_FILE, "Writer is closed");
+
+	if (!reserved.empty())
+	    EXCEPTION(INVALID_OBJECT, "Reserved object " << *reserved.begin() << " has not been written");
+
+	// Other missing ids are free entries
+	std::vector<XRefValue> xref;
+	xref.reserve(offsets.size());
+	for (unsigned int i=1; i<offsets.size(); i++)
+	{
+	    if (offsets[i])
+		xref.push_back(XRefValue(i, offsets[i], 0, true));
+	}
+
+	uint64_t xrefOffset = sink->offset();
+	Parser::writeXref(*sink, xref, true);
+
+	_trailer.deleteKey("Size");
+	_trailer.addData("Size", new Integer(offsets.size()));
+	sink->append("trailer\n");
+	_trailer.serialize(*sink);
+
+	sink->append("startxref\n");
+	sink->appendInteger(xrefOffset);
+	sink->append("\n%%EOF");
+
+	sink->flush();
+	delete sink;
+	sink = 0;
+
+	int ret = ::close(fd);
+	fd = 0;
+	if (ret)
+	    EXCEPTION(UNABLE_TO_WRITE_FILE, "Unable to close file (%m)");
+    }
+}
@@ -0,0 +1,82 @@
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R/PageMode/UseNone>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R]/Count 1>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/MediaBox [0 0 612 792]>>"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Return /PageMode of catalog
+ */
+static std::string pageMode(const std::string& filename)
+{
+    Parser parser;
+
+    parser.parse(filename);
+    Object* catalog = parser.getObject(1);
+
+    if (!catalog || !catalog->hasKey("PageMode"))
+	return "";
+
+    return (*catalog)["PageMode"]->str();
+}
+
+/*
+ * Edit catalog in place, then do a full write
+ */
+static bool editThenWrite(bool update, const std::string& expected)
+{
+    Parser parser;
+
+    parser.parse("copy_in.pdf");
+    Object* catalog = parser.getObject(1);
+
+    catalog->dictionary().replace("PageMode", new Name("/UseOutlines"));
+    if (update)
+	catalog->update();
+
+    parser.write("copy_out.pdf");
+
+    std::string mode = pageMode("copy_out.pdf");
+    CHECK(mode == expected, "Invalid /PageMode " << mode << " (" << expected << " expected)");
+
+    // Other objects are copied verbatim
+    std::string output = readFile("copy_out.pdf");
+    CHECK(output.find("2 0 obj\n<</Type/Pages/Kids [3 0 R]/Count 1>>\nendobj\n") != std::string::npos,
+	  "Pages not copied");
+
+    return true;
+}
+
+/*
+ * Updated object is serialized again
+ */
+static bool updated()
+{
+    return editThenWrite(true, "/UseOutlines");
+}
+
+/*
+ * Objects modified without update() keep their source bytes (documented)
+ */
+static bool notUpdated()
+{
+    return editThenWrite(false, "/UseNone");
+}
+
+int main()
+{
+    writeInput("copy_in.pdf");
+
+    if (!run("updated", updated) ||
+	!run("notUpdated", notUpdated))
+	return 1;
+
+    return 0;
+}
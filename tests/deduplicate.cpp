@@ -0,0 +1,74 @@
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+/*
+ * Both pages have identical widgets (that must stay distinct), identical
+ * fonts (identical once their descriptors are merged) and identical contents
+ */
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R 4 0 R]/Count 2>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/Annots [6 0 R]/Resources <</Font <</F1 8 0 R>>>>/Contents 12 0 R>>"},
+	    {4, "<</Type/Page/Parent 2 0 R/Annots [7 0 R]/Resources <</Font <</F1 9 0 R>>>>/Contents 13 0 R>>"},
+	    {6, "<</Type/Annot/Subtype/Widget/FT/Tx/Rect [0 0 10 10]>>"},
+	    {7, "<</Type/Annot/Subtype/Widget/FT/Tx/Rect [0 0 10 10]>>"},
+	    {8, "<</Type/Font/Subtype/Type1/BaseFont/Helvetica/FontDescriptor 10 0 R>>"},
+	    {9, "<</Type/Font/Subtype/Type1/BaseFont/Helvetica/FontDescriptor 11 0 R>>"},
+	    {10, "<</Type/FontDescriptor/FontName/Helvetica/Flags 32>>"},
+	    {11, "<</Type/FontDescriptor/FontName/Helvetica/Flags 32>>"},
+	    {12, "<</Length 8>>\nstream\nBT /F1 1\nendstream"},
+	    {13, "<</Length 8>>\nstream\nBT /F1 1\nendstream"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Return reference found at path (key or array index) from page
+ */
+static int reference(Object* page, const char* key, const char* subKey=0)
+{
+    DataType* data = (*page)[key];
+
+    if (subKey)
+	data = ((Dictionary*)((Dictionary*)data)->value()["Font"])->value()[subKey];
+    else if (data->type() == DataType::TYPE::ARRAY)
+	data = ((Array*)data)->value()[0];
+
+    return ((Reference*)data)->value();
+}
+
+static bool deduplicate()
+{
+    Parser parser;
+    WriteOptions options;
+
+    parser.parse("deduplicate_in.pdf");
+    options.deduplicate = true;
+    parser.write("deduplicate_out.pdf", options);
+
+    Parser output;
+    output.parse("deduplicate_out.pdf");
+
+    Object* page1 = output.getObject(3);
+    Object* page2 = output.getObject(4);
+    CHECK(page1 && page2, "No pages");
+
+    CHECK(reference(page1, "Annots") == 6 && reference(page2, "Annots") == 7, "Annotations merged");
+    CHECK(reference(page1, "Resources", "F1") == reference(page2, "Resources", "F1"), "Fonts not merged");
+    CHECK(reference(page1, "Contents") == reference(page2, "Contents"), "Contents not merged");
+    CHECK(!output.getObject(11) && output.getObject(10), "Font descriptors not merged");
+
+    return true;
+}
+
+int main()
+{
+    writeInput("deduplicate_in.pdf");
+
+    if (!run("deduplicate", deduplicate))
+	return 1;
+
+    return 0;
+}
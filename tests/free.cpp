@@ -0,0 +1,98 @@
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R]/Count 1>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/MediaBox [0 0 612 792]>>"},
+	    {8, "<</K 8>>"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Return last xref entry of objectId
+ */
+static const XRefValue* xrefEntry(Parser& parser, int objectId)
+{
+    const XRefValue* res = 0;
+
+    for (const XRefValue& value : parser.xrefTable())
+	if (value.objectId() == objectId)
+	    res = &value;
+
+    return res;
+}
+
+/*
+ * Free object is only written as a free xref entry
+ */
+static bool freeWrite()
+{
+    Parser parser;
+
+    parser.parse("free_in.pdf");
+    parser.freeObject(parser.getObject(8));
+    parser.write("free_write.pdf");
+
+    CHECK(readFile("free_write.pdf").find("8 1 obj") == std::string::npos, "Free object written");
+
+    Parser output;
+    output.parse("free_write.pdf");
+    const XRefValue* entry = xrefEntry(output, 8);
+    CHECK(entry && !entry->used() && entry->generationNumber() == 1, "Invalid xref entry");
+
+    return true;
+}
+
+/*
+ * New object reusing a freed id replaces freed object
+ */
+static bool reuse(bool update)
+{
+    std::string filename = update ? "free_update.pdf" : "free_reuse.pdf";
+    Parser parser;
+
+    parser.parse("free_in.pdf");
+    parser.freeObject(parser.getObject(8));
+
+    if (update)
+    {
+	unlink(filename.c_str());
+	parser.write(filename, true);
+    }
+
+    Object* object = parser.newObject();
+    CHECK(object->objectId() == 8 && object->generationNumber() == 1,
+	  "Invalid id " << object->objectId() << " " << object->generationNumber());
+    CHECK(parser.getObject(8, 1) == object, "Freed object still present");
+
+    object->dictionary().addData("K", new Integer(9));
+    parser.write(filename, update);
+
+    Parser output;
+    output.parse(filename);
+    Object* written = output.getObject(8, 1);
+    const XRefValue* entry = xrefEntry(output, 8);
+    CHECK(written && entry && entry->used() && entry->generationNumber() == 1, "New object not written");
+    CHECK(((Integer*)(*written)["K"])->value() == 9, "Invalid new object " << written->str());
+
+    return true;
+}
+
+static bool reuseWrite() { return reuse(false); }
+static bool reuseUpdate() { return reuse(true); }
+
+int main()
+{
+    writeInput("free_in.pdf");
+
+    if (!run("freeWrite", freeWrite) ||
+	!run("reuseWrite", reuseWrite) ||
+	!run("reuseUpdate", reuseUpdate))
+	return 1;
+
+    return 0;
+}
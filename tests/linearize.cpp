@@ -0,0 +1,119 @@
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+static const int nbPages = 3;
+
+/*
+ * Pages share a font, each one has its own contents ((Page n) marker)
+ */
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R 4 0 R 5 0 R]/Count 3>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/Resources 9 0 R/Contents 6 0 R>>"},
+	    {4, "<</Type/Page/Parent 2 0 R/Resources 9 0 R/Contents 7 0 R>>"},
+	    {5, "<</Type/Page/Parent 2 0 R/Resources 9 0 R/Contents 8 0 R>>"},
+	    {6, "<</Length 8>>\nstream\n(Page 1)\nendstream"},
+	    {7, "<</Length 8>>\nstream\n(Page 2)\nendstream"},
+	    {8, "<</Length 8>>\nstream\n(Page 3)\nendstream"},
+	    {9, "<</Font <</F1 10 0 R>>>>"},
+	    {10, "<</Type/Font/Subtype/Type1/BaseFont/Helvetica>>"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Number of occurrences of pattern in data
+ */
+static int count(const std::string& data, const std::string& pattern)
+{
+    int res = 0;
+
+    for (size_t pos = data.find(pattern); pos != std::string::npos; pos = data.find(pattern, pos+1))
+	res++;
+
+    return res;
+}
+
+/*
+ * Linearized write, then read first page and page sections
+ */
+static bool roundTrip()
+{
+    Parser parser;
+    WriteOptions options;
+
+    parser.parse("linearize_in.pdf");
+    options.linearize = true;
+    parser.write("linearize_out.pdf", options);
+
+    std::string output = readFile("linearize_out.pdf");
+    CHECK(output.find("/Linearized") < output.find("(Page 1)"), "Not linearized");
+
+    Parser firstPage;
+    CHECK(firstPage.parseFirstPage("linearize_out.pdf"), "First page not parsed");
+
+    bool hasCatalog = false, hasFirstPage = false;
+    for (Object* object : firstPage.objects())
+    {
+	if (!object->hasKey("Type")) continue;
+	std::string type = (*object)["Type"]->str();
+	hasCatalog |= (type == "/Catalog");
+	hasFirstPage |= (type == "/Page");
+    }
+    CHECK(hasCatalog && hasFirstPage, "Catalog or first page missing");
+
+    off_t previousEnd = 0;
+    for (int i=0; i<nbPages; i++)
+    {
+	off_t offset, length;
+	CHECK(firstPage.pageRange(i, offset, length), "No range for page " << i);
+	CHECK(offset >= previousEnd && length > 0 && offset + length <= (off_t)output.size(),
+	      "Invalid range for page " << i << " : " << offset << " " << length);
+	previousEnd = offset + length;
+
+	// Page object and its own contents. Shared font is only in first
+	// page section (which has all objects used by first page)
+	std::string section = output.substr(offset, length);
+	CHECK(count(section, "/Type/Page") == 1, "Page " << i << " objects not in range");
+	CHECK(section.find("(Page " + std::to_string(i+1) + ")") != std::string::npos,
+	      "Page " << i << " contents not in range");
+	CHECK((section.find("/Helvetica") != std::string::npos) == (i == 0), "Invalid shared font location for page " << i);
+    }
+
+    off_t offset, length;
+    CHECK(!firstPage.pageRange(nbPages, offset, length), "Range after last page");
+
+    firstPage.parseRemaining();
+    int pages = 0;
+    for (Object* object : firstPage.objects())
+	if (object->hasKey("Type") && (*object)["Type"]->str() == "/Page")
+	    pages++;
+    CHECK(pages == nbPages, "Invalid number of pages " << pages);
+
+    return true;
+}
+
+/*
+ * Non linearized file
+ */
+static bool notLinearized()
+{
+    Parser parser;
+
+    CHECK(!parser.parseFirstPage("linearize_in.pdf"), "Input parsed as linearized");
+
+    return true;
+}
+
+int main()
+{
+    writeInput("linearize_in.pdf");
+
+    if (!run("roundTrip", roundTrip) ||
+	!run("notLinearized", notLinearized))
+	return 1;
+
+    return 0;
+}
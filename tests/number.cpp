@@ -0,0 +1,76 @@
+#include <clocale>
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R]/Count 1>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/MediaBox [0 0 612.5 792]>>"},
+	    {4, "[0.5 -.25 +1.5 -3 +4 12345678901234 0.000001]"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Check numbers of object 4
+ */
+static bool checkNumbers(const std::string& filename)
+{
+    static const double expected[] = {0.5, -0.25, 1.5, -3, 4, 12345678901234LL, 0.000001};
+    Parser parser;
+
+    parser.parse(filename);
+    Object* object = parser.getObject(4);
+    CHECK(object && object->data().size() == 1, filename << ": No array");
+
+    std::vector<DataType*>& values = ((Array*)object->data()[0])->value();
+    CHECK(values.size() == sizeof(expected)/sizeof(expected[0]), filename << ": Invalid array " << object->str());
+
+    for (unsigned int i=0; i<values.size(); i++)
+    {
+	double value;
+	if (values[i]->type() == DataType::TYPE::REAL)
+	    value = ((Real*)values[i])->value();
+	else
+	    value = ((Integer*)values[i])->value();
+	CHECK(value == expected[i], filename << ": Invalid value " << values[i]->str());
+    }
+
+    return true;
+}
+
+/*
+ * Write then read back reals, with a comma decimal point locale if available
+ */
+static bool roundTrip()
+{
+    static const char* locales[] = {"de_DE.UTF-8", "fr_FR.UTF-8", "de_DE", "fr_FR"};
+
+    for (unsigned int i=0; i<sizeof(locales)/sizeof(locales[0]); i++)
+    {
+	if (setlocale(LC_ALL, locales[i]))
+	    break;
+    }
+
+    if (!checkNumbers("number_in.pdf"))
+	return false;
+
+    Parser parser;
+    parser.parse("number_in.pdf");
+    parser.getObject(4)->update();
+    parser.write("number_out.pdf");
+
+    return checkNumbers("number_out.pdf");
+}
+
+int main()
+{
+    writeInput("number_in.pdf");
+
+    if (!run("roundTrip", roundTrip))
+	return 1;
+
+    return 0;
+}
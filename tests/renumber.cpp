@@ -0,0 +1,106 @@
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+/*
+ * Catalog references a missing object (7) that will be a valid id
+ * once objects are renumbered
+ */
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R/Extra 7 0 R/Objs [10 0 R 11 0 R 12 0 R 13 0 R 14 0 R 7 0 R]>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R]/Count 1>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/MediaBox [0 0 612 792]>>"},
+	    {10, "<</K 10>>"},
+	    {11, "<</K 11>>"},
+	    {12, "<</K 12>>"},
+	    {13, "<</K 13>>"},
+	    {14, "<</K 14>>"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Dangling reference must not point to another object after renumbering
+ */
+static bool check(const std::string& filename)
+{
+    Parser parser;
+    parser.parse(filename);
+
+    for (auto object : parser.objects())
+    {
+	if (!object->hasKey("Type") || (*object)["Type"]->str() != "/Catalog")
+	    continue;
+
+	if (object->hasKey("Extra"))
+	{
+	    std::cout << filename << ": /Extra points to " << (*object)["Extra"]->str() << std::endl;
+	    return false;
+	}
+
+	std::vector<DataType*>& refs = ((Array*)(*object)["Objs"])->value();
+	if (refs.size() != 6 || refs[5]->type() != DataType::TYPE::NULLOBJECT)
+	{
+	    std::cout << filename << ": Invalid /Objs " << (*object)["Objs"]->str() << std::endl;
+	    return false;
+	}
+
+	for (int i=0; i<5; i++)
+	{
+	    Object* target = parser.getObject(((Reference*)refs[i])->value());
+	    if (!target || !target->hasKey("K") || ((Integer*)(*target)["K"])->value() != 10+i)
+	    {
+		std::cout << filename << ": Invalid reference " << refs[i]->str() << std::endl;
+		return false;
+	    }
+	}
+
+	return true;
+    }
+
+    std::cout << filename << ": No catalog" << std::endl;
+    return false;
+}
+
+int main()
+{
+    try
+    {
+	writeInput("renumber_in.pdf");
+
+	Parser parser;
+	WriteOptions options;
+	parser.parse("renumber_in.pdf");
+	options.renumber = true;
+	parser.write("renumber_out.pdf", options);
+
+	if (!check("renumber_out.pdf"))
+	    return 1;
+
+	// Parser must only know renumbered objects
+	Object* object = parser.getObject(7);
+	if (!object || !object->hasKey("K") || ((Integer*)(*object)["K"])->value() != 13 ||
+	    parser.objects().size() != 8)
+	{
+	    std::cout << "Invalid parser state after renumbering" << std::endl;
+	    return 1;
+	}
+
+	Parser linearized;
+	linearized.parse("renumber_in.pdf");
+	options = WriteOptions();
+	options.linearize = true;
+	linearized.write("renumber_lin.pdf", options);
+
+	if (!check("renumber_lin.pdf"))
+	    return 1;
+    }
+    catch(uPDFParser::Exception& e)
+    {
+	std::cout << e.what() << std::endl;
+	return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R]/Count 1>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/MediaBox [0 0 612 792]/Contents 4 0 R>>"},
+	    {4, "<</Length 5>>\nstream\nHELLO\nendstream"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Check content and /Length of last version of object 4
+ */
+static bool checkStream(const std::string& filename, const std::string& expected)
+{
+    Parser parser;
+    Object* object = 0;
+
+    parser.parse(filename);
+    for (auto it : parser.objects())
+	if (it->objectId() == 4)
+	    object = it;
+
+    CHECK(object && getStream(object), filename << ": No stream");
+
+    std::string data;
+    getStream(object)->readData(data);
+    CHECK(data == expected, filename << ": Invalid data " << data);
+    CHECK(object->hasKey("Length") && ((Integer*)(*object)["Length"])->value() == (int64_t)expected.size(),
+	  filename << ": Invalid /Length " << (*object)["Length"]->str());
+
+    return true;
+}
+
+/*
+ * Replaced data must be written by a full write
+ */
+static bool generatorWrite()
+{
+    static const std::string payload = "GENERATED DATA";
+    Parser parser;
+
+    parser.parse("stream_in.pdf");
+    getStream(parser.getObject(4))->setData(
+	[](unsigned char* buffer, size_t size, size_t offset) {
+	    size = std::min(size, payload.size() - offset);
+	    memcpy(buffer, payload.c_str() + offset, size);
+	    return size;
+	}, payload.size());
+    parser.write("stream_generator.pdf");
+
+    return checkStream("stream_generator.pdf", payload);
+}
+
+/*
+ * Replaced data must be written by an incremental update
+ */
+static bool fileUpdate()
+{
+    static const std::string payload = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    Parser parser;
+
+    std::ofstream("stream_payload.bin", std::ios::binary) << payload;
+
+    parser.parse("stream_in.pdf");
+    getStream(parser.getObject(4))->setData(std::string("stream_payload.bin"));
+    unlink("stream_update.pdf");
+    parser.write("stream_update.pdf", true);
+
+    return checkStream("stream_update.pdf", payload);
+}
+
+/*
+ * Replacing data of a clone must not change original object
+ */
+static bool cloneSetData()
+{
+    static const std::string payload = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    Parser parser;
+
+    std::ofstream("stream_payload.bin", std::ios::binary) << payload;
+
+    parser.parse("stream_in.pdf");
+    Object* original = parser.getObject(4);
+    Object* clone = original->clone();
+    getStream(clone)->setData(std::string("stream_payload.bin"));
+
+    CHECK(((Integer*)(*original)["Length"])->value() == 5, "Original /Length modified");
+    CHECK(((Integer*)(*clone)["Length"])->value() == (int64_t)payload.size(), "Clone /Length not updated");
+
+    std::string data;
+    StringSink sink(data);
+    clone->serializeContent(sink);
+    CHECK(data.find("/Length " + std::to_string(payload.size())) != std::string::npos &&
+	  data.find(payload) != std::string::npos, "Invalid clone " << data);
+
+    delete clone;
+
+    return true;
+}
+
+int main()
+{
+    writeInput("stream_in.pdf");
+
+    if (!run("generatorWrite", generatorWrite) ||
+	!run("fileUpdate", fileUpdate) ||
+	!run("cloneSetData", cloneSetData))
+	return 1;
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+/*
+ * Literal strings of object 4 and their decoded values
+ */
+static const char* literals[] = {
+    "(plain)",
+    "(a\\101\\12b\\0063)",	// Octal escapes (1 to 3 digits)
+    "(one\\\r\ntwo\\\nthree)",	// Line continuations
+    "(x\r\ny\rz)",		// Unescaped end of lines
+    "(p\\(q\\)r\\\\s\\t)",	// Escaped delimiters
+    "(c\\001d)",		// Control character
+    "(\\000\\001\\002\\377)",	// Binary data
+};
+
+static const std::string decoded[] = {
+    "plain",
+    "aA\nb\0063",
+    "onetwothree",
+    "x\ny\nz",
+    "p(q)r\\s\t",
+    std::string("c\001d", 3),
+    std::string("\000\001\002\377", 4),
+};
+
+static const unsigned int nbLiterals = sizeof(literals)/sizeof(literals[0]);
+
+static void writeInput(const std::string& filename)
+{
+    std::string array = "[";
+    for (unsigned int i=0; i<nbLiterals; i++)
+	array += literals[i];
+    array += "<48656C6C6F>]";
+
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R]/Count 1>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/MediaBox [0 0 612 792]>>"},
+	    {4, array},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Decode an hexadecimal string value
+ */
+static std::string decodeHexa(const std::string& value)
+{
+    std::string res;
+
+    for (unsigned int i=0; i+1<value.size(); i+=2)
+	res += (char)std::stoi(value.substr(i, 2), nullptr, 16);
+
+    return res;
+}
+
+/*
+ * Check decoded strings of object 4. Serialized binary data is an
+ * hexadecimal string.
+ */
+static bool checkStrings(const std::string& filename, bool serialized)
+{
+    Parser parser;
+
+    parser.parse(filename);
+    Object* object = parser.getObject(4);
+    CHECK(object && object->data().size() == 1, filename << ": No array");
+
+    std::vector<DataType*>& values = ((Array*)object->data()[0])->value();
+    CHECK(values.size() == nbLiterals+1, filename << ": Invalid array " << object->str());
+
+    for (unsigned int i=0; i<nbLiterals; i++)
+    {
+	std::string value;
+
+	if (values[i]->type() == DataType::TYPE::HEXASTRING)
+	{
+	    CHECK(serialized && i == nbLiterals-1, filename << ": Unexpected hexadecimal string " << values[i]->str());
+	    value = decodeHexa(((HexaString*)values[i])->value());
+	}
+	else
+	{
+	    CHECK(values[i]->type() == DataType::TYPE::STRING, filename << ": Not a string " << values[i]->str());
+	    CHECK(!serialized || i != nbLiterals-1, filename << ": Binary data written as literal");
+	    value = ((String*)values[i])->unescapedValue();
+	}
+
+	CHECK(value == decoded[i], filename << ": Invalid value for " << literals[i] << " : " << values[i]->str());
+    }
+
+    CHECK(values[nbLiterals]->type() == DataType::TYPE::HEXASTRING &&
+	  ((HexaString*)values[nbLiterals])->value() == "48656C6C6F",
+	  filename << ": Invalid hexadecimal string " << values[nbLiterals]->str());
+
+    return true;
+}
+
+/*
+ * Decode, serialize and parse again
+ */
+static bool roundTrip()
+{
+    if (!checkStrings("string_in.pdf", false))
+	return false;
+
+    Parser parser;
+    parser.parse("string_in.pdf");
+    parser.getObject(4)->update();
+    parser.write("string_out.pdf");
+
+    return checkStrings("string_out.pdf", true);
+}
+
+/*
+ * Serialize strings built from decoded values
+ */
+static bool unescaped()
+{
+    for (unsigned int i=0; i<nbLiterals; i++)
+    {
+	std::string output;
+	StringSink sink(output);
+	String string(decoded[i], false);
+
+	string.serialize(sink);
+	CHECK(output.size() > 2, "Empty output for " << literals[i]);
+
+	std::string value;
+	if (output[0] == '<')
+	    value = decodeHexa(output.substr(1, output.size()-2));
+	else
+	    value = String(output.substr(1, output.size()-2)).unescapedValue();
+	CHECK(value == decoded[i], "Invalid output " << output << " for " << literals[i]);
+    }
+
+    return true;
+}
+
+int main()
+{
+    writeInput("string_in.pdf");
+
+    if (!run("roundTrip", roundTrip) ||
+	!run("unescaped", unescaped))
+	return 1;
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#ifndef _TEST_UTILS_H_
+#define _TEST_UTILS_H_
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <uPDFParser.h>
+#include <uPDFParser_common.h>
+
+/*
+ * Failed check : print message and make test fail
+ */
+#define CHECK(cond, msg) do {						\
+	if (!(cond)) {							\
+	    std::cout << __FILE__ << ":" << __LINE__ << ": " << msg << std::endl; \
+	    return false;						\
+	}								\
+    } while (0)
+
+/*
+ * Write a PDF file made of objects (id, content) with a full xref table.
+ * Trailer contains /Size and extra (/Root...) entries.
+ */
+static inline void writeInput(const std::string& filename,
+			      const std::vector<std::pair<int, std::string> >& objects,
+			      const std::string& trailer)
+{
+    std::string data;
+    uPDFParser::StringSink sink(data);
+    std::vector<uPDFParser::XRefValue> xref;
+    int maxId = 0;
+
+    sink.append("%PDF-1.6\n");
+    for (unsigned int i=0; i<objects.size(); i++)
+    {
+	xref.push_back(uPDFParser::XRefValue(objects[i].first, sink.offset(), 0, true));
+	sink.append(std::to_string(objects[i].first) + " 0 obj\n" + objects[i].second + "\nendobj\n");
+	if (objects[i].first > maxId)
+	    maxId = objects[i].first;
+    }
+
+    uint64_t xrefOffset = sink.offset();
+    uPDFParser::Parser::writeXref(sink, xref, true);
+    sink.append("trailer\n<<" + trailer + "/Size " + std::to_string(maxId+1) + ">>\nstartxref\n" +
+		std::to_string(xrefOffset) + "\n%%EOF\n");
+
+    std::ofstream(filename, std::ios::binary) << data;
+}
+
+/*
+ * Read whole file
+ */
+static inline std::string readFile(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+/*
+ * Return first stream of object (0 if none)
+ */
+static inline uPDFParser::Stream* getStream(uPDFParser::Object* object)
+{
+    for (auto data : object->data())
+	if (data->type() == uPDFParser::DataType::TYPE::STREAM)
+	    return (uPDFParser::Stream*)data;
+    return 0;
+}
+
+/*
+ * Run a test function, catching library exceptions
+ */
+static inline bool run(const char* name, bool (*test)())
+{
+    try
+    {
+	if (test())
+	    return true;
+    }
+    catch(uPDFParser::Exception& e)
+    {
+	std::cout << e.what() << std::endl;
+    }
+
+    std::cout << name << " failed" << std::endl;
+    return false;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#include "test_utils.h"
+#include <algorithm>
+
+using namespace uPDFParser;
+
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R]/Count 1>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/MediaBox [0 0 612 792]>>"},
+	    {4, "<</K 4>>"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Updated object removed from parser must not be written by an update
+ */
+static bool removedObject()
+{
+    Parser parser;
+
+    parser.parse("update_in.pdf");
+    Object* object = parser.getObject(4);
+    object->deleteKey("K");
+
+    std::vector<Object*>& objects = parser.objects();
+    objects.erase(std::find(objects.begin(), objects.end(), object));
+
+    unlink("update_removed.pdf");
+    parser.write("update_removed.pdf", true);
+    delete object;
+
+    std::string output = readFile("update_removed.pdf");
+    CHECK(output.find("4 0 obj", output.find("%%EOF")) == std::string::npos, "Removed object written");
+
+    return true;
+}
+
+/*
+ * Return startxref offsets of each revision
+ */
+static std::vector<size_t> startxrefs(const std::string& data)
+{
+    std::vector<size_t> res;
+
+    for (size_t pos = data.find("startxref\n"); pos != std::string::npos;
+	 pos = data.find("startxref\n", pos+1))
+	res.push_back(std::stoul(data.substr(pos + 10)));
+
+    return res;
+}
+
+/*
+ * Each update trailer links to previous cross reference table with /Prev
+ */
+static bool prevChain()
+{
+    static const int nbUpdates = 3;
+    Parser parser;
+
+    parser.parse("update_in.pdf");
+    unlink("update_chain.pdf");
+
+    for (int i=0; i<nbUpdates; i++)
+    {
+	Object* object = parser.getObject(4);
+	object->deleteKey("K");
+	object->dictionary().addData("K", new Integer(5+i));
+	object->update();
+	parser.write("update_chain.pdf", true);
+    }
+
+    std::string output = readFile("update_chain.pdf");
+    std::vector<size_t> offsets = startxrefs(output);
+    CHECK(offsets.size() == nbUpdates+1, "Invalid number of revisions " << offsets.size());
+
+    for (unsigned int i=0; i<offsets.size(); i++)
+    {
+	CHECK(output.compare(offsets[i], 5, "xref\n") == 0, "No xref table at " << offsets[i]);
+
+	size_t trailer = output.find("trailer", offsets[i]);
+	std::string dict = output.substr(trailer, output.find("startxref", trailer) - trailer);
+	size_t prev = dict.find("/Prev ");
+
+	if (i == 0)
+	    CHECK(prev == std::string::npos, "/Prev in original trailer");
+	else
+	    CHECK(prev != std::string::npos && std::stoul(dict.substr(prev + 6)) == offsets[i-1],
+		  "Invalid /Prev for revision " << i << " : " << dict);
+    }
+
+    // Last version is read back
+    Parser result;
+    result.parse("update_chain.pdf");
+    Object* last = 0;
+    for (Object* object : result.objects())
+	if (object->objectId() == 4)
+	    last = object;
+    CHECK(last && ((Integer*)(*last)["K"])->value() == 5+nbUpdates-1, "Invalid last version");
+
+    return true;
+}
+
+int main()
+{
+    writeInput("update_in.pdf");
+
+    if (!run("removedObject", removedObject) ||
+	!run("prevChain", prevChain))
+	return 1;
+
+    return 0;
+}
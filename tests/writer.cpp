@@ -0,0 +1,70 @@
+#include <uPDFWriter.h>
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+/*
+ * Ids skipped by an explicit id are free entries
+ */
+static bool explicitId()
+{
+    Writer writer("writer_explicit.pdf", 1, 7);
+
+    Object catalog(1, 0, 0), pages(5, 0, 0);
+    int pagesId = writer.write(pages);
+    catalog.dictionary().addData("Type", new Name("/Catalog"));
+    catalog.dictionary().addData("Pages", new Reference(pagesId, 0));
+    pages.dictionary().addData("Type", new Name("/Pages"));
+    writer.write(catalog);
+    writer.trailer().addData("Root", new Reference(1, 0));
+    writer.close();
+
+    CHECK(readFile("writer_explicit.pdf").compare(0, 9, "%PDF-1.7\r") == 0, "Invalid header");
+
+    Parser parser;
+    parser.parse("writer_explicit.pdf");
+    CHECK(parser.getObject(1) && parser.getObject(5), "Objects not written");
+
+    for (const XRefValue& value : parser.xrefTable())
+    {
+	bool used = (value.objectId() == 1 || value.objectId() == 5);
+	CHECK(value.used() == used, "Invalid xref entry for " << value.objectId());
+    }
+
+    return true;
+}
+
+/*
+ * Reserved ids must be written
+ */
+static bool reservedId()
+{
+    Writer writer("writer_reserved.pdf");
+    Object object;
+
+    int reserved = writer.reserve();
+    writer.write(object);
+
+    bool error = false;
+    try
+    {
+	writer.close();
+    }
+    catch (Exception& e)
+    {
+	error = true;
+    }
+
+    CHECK(error, "Reserved id " << reserved << " not written, but no error");
+
+    return true;
+}
+
+int main()
+{
+    if (!run("explicitId", explicitId) ||
+	!run("reservedId", reservedId))
+	return 1;
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "test_utils.h"
+
+using namespace uPDFParser;
+
+static void writeInput(const std::string& filename)
+{
+    writeInput(filename, {
+	    {1, "<</Type/Catalog/Pages 2 0 R>>"},
+	    {2, "<</Type/Pages/Kids [3 0 R]/Count 1>>"},
+	    {3, "<</Type/Page/Parent 2 0 R/MediaBox [0 0 612 792]/Contents 6 0 R>>"},
+	    {4, "<</K 4>>"},
+	    {6, "<</Length 8>>\nstream\nBT /F1 1\nendstream"},
+	}, "/Root 1 0 R");
+}
+
+/*
+ * Write input with xref table or xref stream, then check output is
+ * parsed back with the same objects
+ */
+static bool writeXref(bool xrefStream)
+{
+    std::string filename = xrefStream ? "xref_stream.pdf" : "xref_table.pdf";
+    Parser parser;
+    WriteOptions options;
+
+    parser.parse("xref_in.pdf");
+    parser.getObject(4)->update();
+    options.xrefStream = xrefStream;
+    parser.write(filename, options);
+
+    std::string output = readFile(filename);
+    size_t startxref = output.rfind("startxref\n");
+    CHECK(startxref != std::string::npos, "No startxref");
+    size_t xrefOffset = std::stoul(output.substr(startxref + 10));
+
+    if (xrefStream)
+    {
+	CHECK(output.find("/XRef", xrefOffset) < startxref, "No xref stream at " << xrefOffset);
+	CHECK(output.find("trailer") == std::string::npos, "Trailer written");
+    }
+    else
+    {
+	CHECK(output.compare(xrefOffset, 7, "xref\n0 ") == 0, "No xref table at " << xrefOffset);
+	CHECK(output.find("trailer", xrefOffset) < startxref, "No trailer");
+    }
+
+    Parser result;
+    result.parse(filename);
+
+    Object* contents = result.getObject(6);
+    CHECK(contents && getStream(contents), "No contents stream");
+
+    if (xrefStream)
+    {
+	// Objects packed into object streams are not parsed
+	Object *xref = 0, *objStm = 0;
+	for (Object* object : result.objects())
+	{
+	    if (!object->hasKey("Type")) continue;
+	    std::string type = (*object)["Type"]->str();
+	    if (type == "/XRef") xref = object;
+	    else if (type == "/ObjStm") objStm = object;
+	}
+
+	CHECK(xref && xref->hasKey("Root") && ((Integer*)(*xref)["Size"])->value() >= 7, "Invalid xref stream");
+	CHECK(objStm && ((Integer*)(*objStm)["N"])->value() == 4, "Invalid object stream");
+    }
+    else
+    {
+	CHECK(result.getTrailer().hasKey("Root"), "No /Root in trailer");
+	for (int i=1; i<=6; i++)
+	{
+	    bool used = false;
+	    for (const XRefValue& value : result.xrefTable())
+		if (value.objectId() == i)
+		    used = value.used();
+	    CHECK(used == (i != 5), "Invalid xref entry for " << i);
+	}
+
+	Object* object = result.getObject(4);
+	CHECK(object && ((Integer*)(*object)["K"])->value() == 4, "Invalid object 4");
+    }
+
+    return true;
+}
+
+static bool xrefTable() { return writeXref(false); }
+static bool xrefStream() { return writeXref(true); }
+
+int main()
+{
+    writeInput("xref_in.pdf");
+
+    if (!run("xrefTable", xrefTable) ||
+	!run("xrefStream", xrefStream))
+	return 1;
+
+    return 0;
+}